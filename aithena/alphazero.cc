@@ -29,20 +29,32 @@ enum GetOptOption : int {
   kOptEvalLogPath,
   kOptEvalLogType,
   kOptMCTSSimulations,
+  kOptMCTSRolloutDepth,
+  kOptMCTSTime,
+  kOptMCTSMemory,
   kOptBatchSize,
   kOptReplaySize,
   kOptSimulations,
   kOptUpdate,
   kOptSave,
   kOptSaveTimestamp,
+  kOptSelfPlayWorkers,
+  kOptGradAccumulation,
+  kOptTrainSteps,
   kOptAZLearningRate,
   kOptAZNeurons,
   kOptAZResLayers,
   kOptAZWeightDecay,
   kOptDiscountFactor,
+  kOptEvalBatchSize,
+  kOptEvalCache,
+  kOptInferenceDtype,
   kOptLoad,
   kOptNoCuda,
   kOptPowerUCTP,
+  kOptPriorSoftmax,
+  kOptQuantize,
+  kOptSimd,
   kOptFEN,
   kOptMaxMoves,
   kOptMaxNoProgress
@@ -60,15 +72,27 @@ std::string GetAlphazeroUsageText() {
          "  --mcts-simulations <number> Number of MCTS simulations (default: " +
          std::to_string(MCTS::kDefaultSimulations) +
          ")\n"
+         "  --mcts-rollout-depth <number> Maximum number of moves per MCTS rollout (0 = unlimited, default: " +
+         std::to_string(RolloutEngine::kDefaultMaxDepth) +
+         ")\n"
+         "  --mcts-time <ms>            Maximum MCTS search time per move (default: no limit)\n"
+         "  --mcts-memory <MB>          Maximum MCTS tree size, the tree is pruned beyond (default: no limit)\n"
          "## Training Options ##\n"
          "  --batch-size <number>       Neural net. update batch size (default: " +
          std::to_string(AlphaZero::kDefaultBatchSize) +
          ")\n"
          "  --epochs -e <number>        Number of epochs (default: 10)\n"
+         "  --grad-accumulation <number> Batches accumulated per optimizer step, splits the batch size (default: " +
+         std::to_string(AlphaZero::kDefaultGradientAccumulation) +
+         ")\n"
          "  --replay-size <number>      Size of the replay memory (0 = infinite, default: infinite)\n"
          "  --rounds -r <number>        Number of training rounds (default: 100)\n"
          "  --save <path>               Path for saving NN (a suffix will be appended)\n"
          "  --save-timestamp            Save a timestamped network file (default: false)\n"
+         "  --selfplay-workers <number> Number of concurrent self-play games (default: 1)\n"
+         "  --train-steps <number>      Optimizer steps per training round (default: " +
+         std::to_string(AlphaZero::kDefaultTrainingSteps) +
+         ")\n"
          "## Alphazero Options ##\n"
          "  --az-learning-rate <number> Learning rate for ADAM optimizer (default: " +
          std::to_string(AlphaZero::kDefaultAdamLearningRate) +
@@ -81,11 +105,19 @@ std::string GetAlphazeroUsageText() {
          "  --discount-factor <number>  Discount factor (default: " +
          std::to_string(AlphaZero::kDefaultDiscountFactor) +
          ")\n"
+         "  --eval-batch-size <number>  Leaves evaluated per forward pass during search (default: " +
+         std::to_string(AlphaZero::kDefaultEvalBatchSize) +
+         ")\n"
+         "  --eval-cache <number>       Entries of the evaluation cache, 0 disables it (default: 0)\n"
+         "  --inference-dtype <type>    Type of the weights used for search: f32 or bf16 (default: f32)\n"
          "  --load <path>               Path for loading NN (suffix will be appended)\n"
          "  --no-cuda                   Disables using cuda\n"
          "  --poweruct-p <number>       The p-value for PowerUCT (default: " +
          std::to_string(AlphaZero::kDefaultPowerUCTP) +
          ")\n"
+         "  --prior-softmax             Normalize priors with a softmax over the legal moves\n"
+         "  --quantize                  Search with an int8 copy of the NN calibrated on the replay memory\n"
+         "  --simd                      Search with the SIMD engine instead of libtorch (5x5, 6x6 and 8x8 boards)\n"
          "  --simulations <number>      Number of simulations (default: " +
          std::to_string(AlphaZero::kDefaultSimulations) +
          ")\n"
@@ -117,10 +149,13 @@ void PrintProgress(double progress = 0.0, int width = 80, std::string prefix = "
 }
 
 std::tuple<int, int> Evaluate(std::shared_ptr<AlphaZero> az, chess::State::StatePtr state,
-                              int mcts_simulations = MCTS::kDefaultSimulations) {
+                              SearchBudget mcts_budget = {MCTS::kDefaultSimulations, 0, 0, 0, false},
+                              int mcts_rollout_depth = RolloutEngine::kDefaultMaxDepth) {
   chess::Game::GamePtr game = az->GetGame();
   MCTS mcts(game);
-  mcts.SetSimulations(mcts_simulations);
+  mcts.SetBudget(mcts_budget);
+  mcts.SetRolloutDepth(mcts_rollout_depth);
+  mcts.StartSession();
   chess::State::StatePtr current_state = state;
   int steps = 0;
 
@@ -160,6 +195,9 @@ int RunAlphazero(int argc, char** argv) {
                                          {"help", no_argument, nullptr, 'h'},
                                          {"train", no_argument, nullptr, kOptTrain},
                                          {"mcts-simulations", required_argument, nullptr, kOptMCTSSimulations},
+                                         {"mcts-rollout-depth", required_argument, nullptr, kOptMCTSRolloutDepth},
+                                         {"mcts-time", required_argument, nullptr, kOptMCTSTime},
+                                         {"mcts-memory", required_argument, nullptr, kOptMCTSMemory},
                                          {"batch-size", required_argument, nullptr, kOptBatchSize},
                                          {"epochs", required_argument, nullptr, 'e'},
                                          {"evaluations", required_argument, nullptr, kOptEvaluations},
@@ -169,14 +207,23 @@ int RunAlphazero(int argc, char** argv) {
                                          {"rounds", required_argument, nullptr, 'r'},
                                          {"save", required_argument, nullptr, kOptSave},
                                          {"save-timestamp", no_argument, nullptr, kOptSaveTimestamp},
+                                         {"selfplay-workers", required_argument, nullptr, kOptSelfPlayWorkers},
+                                         {"grad-accumulation", required_argument, nullptr, kOptGradAccumulation},
+                                         {"train-steps", required_argument, nullptr, kOptTrainSteps},
                                          {"az-learning-rate", required_argument, nullptr, kOptAZLearningRate},
                                          {"az-neurons", required_argument, nullptr, kOptAZNeurons},
                                          {"az-res-layers", required_argument, nullptr, kOptAZResLayers},
                                          {"az-weight-decay", required_argument, nullptr, kOptAZWeightDecay},
                                          {"discount-factor", required_argument, nullptr, kOptDiscountFactor},
+                                         {"eval-batch-size", required_argument, nullptr, kOptEvalBatchSize},
+                                         {"eval-cache", required_argument, nullptr, kOptEvalCache},
+                                         {"inference-dtype", required_argument, nullptr, kOptInferenceDtype},
                                          {"load", required_argument, nullptr, kOptLoad},
                                          {"no-cuda", no_argument, nullptr, kOptNoCuda},
                                          {"poweruct-p", required_argument, nullptr, kOptPowerUCTP},
+                                         {"prior-softmax", no_argument, nullptr, kOptPriorSoftmax},
+                                         {"quantize", no_argument, nullptr, kOptQuantize},
+                                         {"simd", no_argument, nullptr, kOptSimd},
                                          {"simulations", required_argument, nullptr, kOptSimulations},
                                          {"update", required_argument, nullptr, kOptUpdate},
                                          {"fen", required_argument, nullptr, kOptFEN},
@@ -197,6 +244,9 @@ int RunAlphazero(int argc, char** argv) {
   int az_res_layers{19};
   double az_weight_decay{AlphaZero::kDefaultAdamWeightDecay};
   double discount_factor{AlphaZero::kDefaultDiscountFactor};
+  int eval_batch_size{AlphaZero::kDefaultEvalBatchSize};
+  int eval_cache_size{0};
+  std::string inference_dtype{"f32"};
   std::string fen{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"};
   int max_no_progress{50};
   int max_moves{1000};
@@ -204,12 +254,21 @@ int RunAlphazero(int argc, char** argv) {
   std::string load_path{""};
   bool use_cuda{torch::cuda::cudnn_is_available()};
   double power_uct_p{AlphaZero::kDefaultPowerUCTP};
+  bool prior_softmax{false};
+  bool quantize{false};
+  bool simd{false};
   bool evaluate_mode{false};
   bool training_mode{false};
   int mcts_simulations{MCTS::kDefaultSimulations};
+  int mcts_rollout_depth{RolloutEngine::kDefaultMaxDepth};
+  long mcts_time{0};
+  long mcts_memory{0};
   int replay_memory_size{0};
   std::string update{"puct"};
   bool save_timestamp{false};
+  int selfplay_workers{1};
+  int gradient_accumulation{AlphaZero::kDefaultGradientAccumulation};
+  int training_steps{AlphaZero::kDefaultTrainingSteps};
 
   int long_index = 0;
   int opt = 0;
@@ -242,6 +301,18 @@ int RunAlphazero(int argc, char** argv) {
         mcts_simulations = atoi(optarg);
         std::cout << "MCTS simulations: " << mcts_simulations << std::endl;
         break;
+      case kOptMCTSRolloutDepth:
+        mcts_rollout_depth = atoi(optarg);
+        std::cout << "MCTS rollout depth: " << mcts_rollout_depth << std::endl;
+        break;
+      case kOptMCTSTime:
+        mcts_time = atol(optarg);
+        std::cout << "MCTS time: " << mcts_time << "ms" << std::endl;
+        break;
+      case kOptMCTSMemory:
+        mcts_memory = atol(optarg);
+        std::cout << "MCTS memory: " << mcts_memory << "MB" << std::endl;
+        break;
       case kOptBatchSize:
         batch_size = atoi(optarg);
         std::cout << "Batch size: " << batch_size << std::endl;
@@ -290,6 +361,18 @@ int RunAlphazero(int argc, char** argv) {
         save_timestamp = true;
         std::cout << "Saving with timestamp enabled" << std::endl;
         break;
+      case kOptSelfPlayWorkers:
+        selfplay_workers = atoi(optarg);
+        std::cout << "Self-play workers: " << selfplay_workers << std::endl;
+        break;
+      case kOptGradAccumulation:
+        gradient_accumulation = atoi(optarg);
+        std::cout << "Gradient accumulation: " << gradient_accumulation << std::endl;
+        break;
+      case kOptTrainSteps:
+        training_steps = atoi(optarg);
+        std::cout << "Training steps: " << training_steps << std::endl;
+        break;
       case kOptAZLearningRate:
         az_learning_rate = atof(optarg);
         std::cout << "AlphaZero learning rate: " << az_learning_rate << std::endl;
@@ -310,6 +393,18 @@ int RunAlphazero(int argc, char** argv) {
         discount_factor = atof(optarg);
         std::cout << "Discount factor: " << discount_factor << std::endl;
         break;
+      case kOptEvalBatchSize:
+        eval_batch_size = atoi(optarg);
+        std::cout << "Evaluation batch size: " << eval_batch_size << std::endl;
+        break;
+      case kOptEvalCache:
+        eval_cache_size = atoi(optarg);
+        std::cout << "Evaluation cache size: " << eval_cache_size << std::endl;
+        break;
+      case kOptInferenceDtype:
+        inference_dtype = static_cast<std::string>(optarg);
+        std::cout << "Inference dtype: " << inference_dtype << std::endl;
+        break;
       case kOptLoad:
         load_path = static_cast<std::string>(optarg);
         std::cout << "Load path: " << load_path << std::endl;
@@ -322,6 +417,18 @@ int RunAlphazero(int argc, char** argv) {
         power_uct_p = atof(optarg);
         std::cout << "PowerUCT p: " << power_uct_p << std::endl;
         break;
+      case kOptPriorSoftmax:
+        prior_softmax = true;
+        std::cout << "Normalizing priors with softmax" << std::endl;
+        break;
+      case kOptQuantize:
+        quantize = true;
+        std::cout << "Quantizing NN for search" << std::endl;
+        break;
+      case kOptSimd:
+        simd = true;
+        std::cout << "Using the SIMD engine for search" << std::endl;
+        break;
       case kOptFEN:
         fen = static_cast<std::string>(optarg);
         std::cout << "FEN: " << fen << std::endl;
@@ -361,13 +468,44 @@ int RunAlphazero(int argc, char** argv) {
     az.SetUseCUDA(true);
   }
 
-  if (!load_path.empty()) az.GetNetwork()->Load(load_path);
+  if (!load_path.empty()) az.Load(load_path);
 
   az.GetReplayMemory()->SetMinSize(std::min(replay_memory_size, batch_size));
   az.GetReplayMemory()->SetMaxSize(replay_memory_size);
 
   az.SetBatchSize(batch_size);
+  az.SetTrainingSteps(training_steps);
+  az.SetGradientAccumulation(gradient_accumulation);
   az.SetSimulations(simulations);
+  az.SetEvalBatchSize(eval_batch_size);
+  az.SetPriorSoftmax(prior_softmax);
+  if (eval_cache_size > 0) az.SetEvalCache(std::make_shared<EvalCache>(static_cast<std::size_t>(eval_cache_size)));
+
+  if (inference_dtype == "bf16") {
+    az.SetInferenceDtype(torch::kBFloat16);
+
+    if (!SupportsInferenceDtype(torch::kBFloat16, use_cuda))
+      std::cout << "No native bf16 support, using f32 for inference" << std::endl;
+  } else if (inference_dtype != "f32") {
+    std::cout << "Invalid inference dtype: " << inference_dtype << std::endl;
+    return -1;
+  }
+
+  if (quantize) {
+    az.SetQuantization(true);
+
+    if (!SupportsQuantization()) std::cout << "No quantized engine available, using float for inference" << std::endl;
+  }
+
+  if (simd) {
+    az.SetSimdInference(true);
+
+    int width = game->GetOption("board_width");
+    int height = game->GetOption("board_height");
+
+    if (use_cuda || !SimdNetwork::IsSupported(width, height, az_neurons))
+      std::cout << "No SIMD kernels for the board and neuron count, using libtorch for inference" << std::endl;
+  }
   az.SetDiscountFactor(discount_factor);
 
   az.SetAdamLearningRate(az_learning_rate);
@@ -382,10 +520,15 @@ int RunAlphazero(int argc, char** argv) {
     return -1;
   }
 
+  // A time limit stops the search early once the move is decided, otherwise exactly mcts_simulations are run.
+  SearchBudget mcts_budget{mcts_simulations, mcts_time, 0, static_cast<std::size_t>(mcts_memory) * 1024 * 1024,
+                           mcts_time > 0};
+
   if (evaluate_mode) {
     chess::State::StatePtr current_state = state;
 
-    for (int i = 0; i < evaluations; ++i) Evaluate(std::make_shared<AlphaZero>(az), state, mcts_simulations);
+    for (int i = 0; i < evaluations; ++i)
+      Evaluate(std::make_shared<AlphaZero>(az), state, mcts_budget, mcts_rollout_depth);
 
     return 0;
   }
@@ -410,7 +553,7 @@ int RunAlphazero(int argc, char** argv) {
 
     PrintProgress(sample_count / min_sample_count, 80, "Gathering Samples ");
 
-    az.SelfPlay(state);
+    az.ParallelSelfPlay(selfplay_workers, selfplay_workers, state);
 
     bn.End();
   }
@@ -425,15 +568,18 @@ int RunAlphazero(int argc, char** argv) {
     for (int i = 0; i < rounds; ++i) {
       PrintProgress(static_cast<double>(i) / static_cast<double>(rounds), 80, "Training ");
 
-      az.SelfPlay(state);
+      az.ParallelSelfPlay(selfplay_workers, selfplay_workers, state);
 
       az.TrainNetwork();
     }
 
+    // The quantized copy of the last round of self-play
+    if (quantize && az.GetQuantizationReport().samples > 0) std::cout << az.GetQuantizationReport();
+
     double total_j = 0;
     double total_evaluation = 0;
     for (int i = 0; i < evaluations; ++i) {
-      auto evaluation = Evaluate(std::make_shared<AlphaZero>(az), state, mcts_simulations);
+      auto evaluation = Evaluate(std::make_shared<AlphaZero>(az), state, mcts_budget, mcts_rollout_depth);
       int result = std::get<0>(evaluation);
       int steps = std::get<1>(evaluation);
 
@@ -462,9 +608,9 @@ int RunAlphazero(int argc, char** argv) {
     }
 
     if (!save_path.empty()) {
-      az.GetNetwork()->Save(save_path);
+      az.Save(save_path);
 
-      if (save_timestamp) az.GetNetwork()->Save(save_path + "-" + GetTimestamp());
+      if (save_timestamp) az.Save(save_path + "-" + GetTimestamp());
     }
 
     bn.End();
@@ -5,12 +5,30 @@
 #include "alphazero/alphazero.h"
 
 #include <float.h>
-#include <time.h>
 #include <torch/torch.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
 #include <functional>
+#include <future>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "alphazero/batch_loader.h"
 #include "alphazero/nn.h"
 #include "chess/util.h"
 #include "util/dirichlet.h"
@@ -24,36 +42,44 @@ AlphaZero::AlphaZero(chess::Game::GamePtr game, AlphaZeroNet net, std::shared_pt
   random_generator_ = std::mt19937(std::random_device()());
 
   if (!net) SetUseCUDA(torch::cuda::cudnn_is_available());
-
-  srand(static_cast<unsigned>(time(NULL)));
 }
 
 void AlphaZero::SelfPlay(chess::State::StatePtr start) {
   benchmark_.Start("SelfPlay");
 
   chess::State::StatePtr state = start == nullptr ? game_->GetInitialState() : start;
-  std::vector<AZNode::AZNodePtr> nodes = {std::make_shared<AZNode>(game_, state)};  // Required to keep weak_ptrs alive
-  AZNode::AZNodePtr node = nodes.back();
-
-  // Run game
+  // Past positions are required to keep the weak_ptrs alive and provide the history of the network inputs, which are
+  // only encoded once the game is over.
+  std::vector<AZNode::AZNodePtr> nodes = {std::make_shared<AZNode>(game_, state)};
+  // Policy target of each position, as output indices and visit shares of the tried moves
+  std::vector<std::vector<std::pair<int64_t, float>>> policies;
+
+  // Run game. The subtree of the chosen child is reused by the next search, the siblings are released once the policy
+  // target of the position was taken.
   while (!nodes.back()->IsTerminal() && nodes.back()->GetStateRepetitions() < 3) {
-    node = DrawAction(node);
+    AZNode::AZNodePtr node = nodes.back();
+    AZNode::AZNodePtr next_node = DrawAction(node);
 
-    node->SetParent(nodes.back());
-    nodes.push_back(node);
+    policies.push_back(GetSparseNNOutput(node));
+    node->Collapse();
+
+    nodes.push_back(next_node);
   }
 
-  int result = node->IsTerminal() ? game_->GetStateResult(node->GetState()) : 0;
+  policies.push_back(GetSparseNNOutput(nodes.back()));
+
+  int result = nodes.back()->IsTerminal() ? game_->GetStateResult(nodes.back()->GetState()) : 0;
 
-  // Store samples in replay memory
+  // Store samples in replay memory, starting with the final position
 
+  Board &board = state->GetBoard();
   bool negate = false;
   int i = 0;
-  while (node != nullptr) {
+  for (std::size_t j = nodes.size(); j-- > 0;) {
     double value = pow(discount_factor_, static_cast<double>(i)) * static_cast<double>(negate ? -result : result);
-    replay_memory_->AddSample(GetNNInput(node), GetNNOutput(node), value);
+    replay_memory_->AddSample(GetNNInput(nodes[j]), GetNNOutput(policies[j], board.GetWidth(), board.GetHeight()),
+                              value);
 
-    node = node->GetParent();
     negate = !negate;
     ++i;
   }
@@ -61,52 +87,98 @@ void AlphaZero::SelfPlay(chess::State::StatePtr start) {
   benchmark_.End("SelfPlay");
 }
 
-void AlphaZero::TrainNetwork() {
-  benchmark_.Start("TrainNetwork");
+void AlphaZero::ParallelSelfPlay(int games, int workers, chess::State::StatePtr start) {
+  if (workers <= 1) {
+    for (int i = 0; i < games; ++i) SelfPlay(start);
+    return;
+  }
+
+  std::shared_ptr<InferenceServer> server = inference_server_;
+  if (server == nullptr) server = std::make_shared<InferenceServer>(GetInferenceNetwork(), workers * eval_batch_size_);
+
+  std::atomic<int> next_game{0};
+  std::mutex exception_mutex;
+  std::exception_ptr exception{nullptr};
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < workers; ++i) {
+    // Copies of the search settings with their own rules (the game's benchmarks are not thread-safe) and generator
+    AlphaZero worker{*this};
+    worker.game_ = std::make_shared<chess::Game>(*game_);
+    worker.random_generator_.seed(random_generator_());
+    worker.benchmark_ = BenchmarkSet();
+    worker.SetInferenceServer(server);
+
+    threads.emplace_back([worker, games, start, &next_game, &exception_mutex, &exception]() mutable {
+      try {
+        while (next_game++ < games) worker.SelfPlay(start);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(exception_mutex);
+        if (exception == nullptr) exception = std::current_exception();
+      }
+    });
+  }
+
+  for (auto &thread : threads) thread.join();
 
-  int width = game_->GetOption("board_width");
-  int height = game_->GetOption("board_height");
+  if (exception != nullptr) std::rethrow_exception(exception);
+}
 
-  torch::optim::Adam optimizer(network_->parameters(),
-                               torch::optim::AdamOptions(adam_learning_rate_).weight_decay(adam_weight_decay_));
+void AlphaZero::TrainNetwork() {
+  // The batch loader would wait for the first sample.
+  if (replay_memory_->GetSampleCount() == 0) throw std::out_of_range("The replay memory is empty");
 
-  torch::Tensor input_batch = torch::empty({0, network_->kInputSize, width, height});
-  torch::Tensor true_action_value_batch = torch::empty({0, GetNNOutputSize(game_), width, height});
-  torch::Tensor true_state_value_batch = torch::empty({0});
+  benchmark_.Start("TrainNetwork");
 
-  for (int i = 0; i < batch_size_; ++i) {
-    auto sample = replay_memory_->GetSample();
+  bool disable_cuda = disable_cuda_update_ && network_->UsesCUDA();
 
-    torch::Tensor input = std::get<0>(sample);
-    torch::Tensor action_values = std::get<0>(std::get<1>(sample));
-    double state_value = std::get<1>(std::get<1>(sample));
+  // Each step accumulates the gradients of gradient_accumulation_ batches, which add up to the batch size.
+  int accumulation_batch_size = (batch_size_ + gradient_accumulation_ - 1) / gradient_accumulation_;
 
-    input_batch = torch::cat({input_batch, input});
-    true_action_value_batch = torch::cat({true_action_value_batch, action_values});
-    true_state_value_batch = torch::cat({true_state_value_batch, torch::from_blob(&state_value, {1}, torch::kFloat64)});
+  // Page-locked batches are copied to CUDA faster.
+  if (batch_loader_ == nullptr || batch_loader_->GetBatchSize() != accumulation_batch_size) {
+    bool pin_memory = network_->UsesCUDA() && !disable_cuda;
+    batch_loader_ = std::make_shared<BatchLoader>(replay_memory_, accumulation_batch_size, pin_memory);
   }
 
-  bool disable_cuda = disable_cuda_update_ && network_->UsesCUDA();
   if (disable_cuda) network_->to(torch::kCPU);
 
-  std::tuple<torch::Tensor, torch::Tensor> output = network_->forward(input_batch, true);
+  std::shared_ptr<torch::optim::Adam> optimizer = GetOptimizer();
 
-  if (!disable_cuda && network_->UsesCUDA()) {
-    true_action_value_batch = true_action_value_batch.to(torch::kCUDA);
-    true_state_value_batch = true_state_value_batch.to(torch::kCUDA);
-  }
+  for (int step = 0; step < training_steps_; ++step) {
+    optimizer->zero_grad();
+
+    for (int i = 0; i < gradient_accumulation_; ++i) {
+      ReplayMemory::Batch batch = batch_loader_->Next();
+
+      torch::Tensor input_batch = std::get<0>(batch);
+      torch::Tensor true_action_value_batch = std::get<1>(batch);
+      torch::Tensor true_state_value_batch = std::get<2>(batch);
+
+      std::tuple<torch::Tensor, torch::Tensor> output = network_->forward(input_batch, true);
 
-  torch::Tensor predicted_action_value_batch = torch::clamp(std::get<0>(output), 1e-8, 1.);
-  torch::Tensor predicted_state_value_batch = std::get<1>(output);
+      if (!disable_cuda && network_->UsesCUDA()) {
+        true_action_value_batch = true_action_value_batch.to(torch::kCUDA);
+        true_state_value_batch = true_state_value_batch.to(torch::kCUDA);
+      }
 
-  torch::Tensor state_value_loss = torch::mean(torch::square(true_state_value_batch - predicted_state_value_batch));
-  torch::Tensor action_value_loss = torch::sum(true_action_value_batch * torch::log(predicted_action_value_batch));
+      torch::Tensor predicted_action_value_batch = torch::clamp(std::get<0>(output), 1e-8, 1.);
+      torch::Tensor predicted_state_value_batch = std::get<1>(output);
 
-  torch::Tensor loss = state_value_loss - action_value_loss;
+      torch::Tensor state_value_loss = torch::mean(torch::square(true_state_value_batch - predicted_state_value_batch));
+      torch::Tensor action_value_loss = torch::sum(true_action_value_batch * torch::log(predicted_action_value_batch));
 
-  optimizer.zero_grad();
-  loss.backward();
-  optimizer.step();
+      // The accumulated loss equals the loss of a single batch: the mean state value loss is averaged over the batches,
+      // the summed action value loss is summed.
+      torch::Tensor loss = state_value_loss / gradient_accumulation_ - action_value_loss;
+
+      loss.backward();
+    }
+
+    optimizer->step();
+  }
+
+  network_->IncrementGeneration();
 
   if (disable_cuda) network_->to(torch::kCUDA);
 
@@ -117,7 +189,7 @@ double AlphaZero::EvaluateState(chess::State::StatePtr state) {
   AZNode::AZNodePtr node = std::make_shared<AZNode>(game_, state);
 
   torch::Tensor input = GetNNInput(node);
-  auto output = network_->forward(input);
+  auto output = Evaluate(input);
 
   double state_value = std::get<1>(output)[0].item<double>();
 
@@ -144,28 +216,63 @@ chess::State::StatePtr AlphaZero::DrawAction(chess::State::StatePtr state) {
 AZNode::AZNodePtr AlphaZero::DrawAction(AZNode::AZNodePtr start) {
   benchmark_.Start("DrawAction");
 
-  // Initialize root and add dirchilet noise
-  torch::Tensor input = GetNNInput(start);
-  std::tuple<torch::Tensor, torch::Tensor> output = network_->forward(input);
+  auto search_start = std::chrono::steady_clock::now();
+  report_.Clear();
 
-  torch::Tensor action_values = std::get<0>(output);
+  // Initialize root and add dirchilet noise. A root that was visited by a previous search (e.g. the child chosen by the
+  // last call) has already been evaluated and keeps its priors.
+  std::vector<double> priors;
 
-  start->Expand();
-  for (auto child : start->GetChildren()) {
-    double action_value = GetNNOutput(action_values, child);
+  if (start->IsExpanded() && start->GetVisitCount() > 0) {
+    if (start->GetChildStatistics() != nullptr) priors = start->GetChildStatistics()->priors;
+  } else {
+    if (!start->IsExpanded()) {
+      start->Expand();
+      report_.nodes_allocated += static_cast<long>(start->GetChildCount());
+    }
+
+    Evaluation evaluation = Evaluate(std::vector<AZNode::AZNodePtr>{start}).front();
+    priors.assign(evaluation.priors.begin(), evaluation.priors.end());
+  }
+
+  std::vector<AZNode::AZNodePtr> children = start->GetChildren();
+
+  for (std::size_t i = 0; i < children.size(); ++i) {
     double noise = dirichlet_noise_(random_generator_)[0];
 
-    child->SetPrior(.75 * action_value + .25 * noise);
+    children[i]->SetPrior(.75 * priors[i] + .25 * noise);
   }
 
   // Remove parent-connection from node that would be problematic during backpropagation.
   AZNode::AZNodePtr parent = start->GetParent();
   start->SetParent(nullptr);
 
-  for (int i = 0; i < simulations_; ++i) Simulate(start);
+  if (eval_batch_size_ > 1) {
+    for (int i = 0; i < simulations_;) i += SimulateBatch(start, std::min(eval_batch_size_, simulations_ - i));
+  } else {
+    for (int i = 0; i < simulations_; ++i) Simulate(start);
+  }
 
   start->SetParent(parent);
 
+  // Remove the noise, the tree may be searched again.
+  for (std::size_t i = 0; i < children.size(); ++i) children[i]->SetPrior(priors[i]);
+
+  report_.simulations = simulations_;
+  report_.time =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - search_start).count();
+
+  std::vector<AZNode::AZNodePtr> stack{start};
+  while (!stack.empty()) {
+    AZNode::AZNodePtr node = stack.back();
+    stack.pop_back();
+
+    report_.tree_nodes += 1;
+    report_.tree_memory += node->GetMemoryUsage();
+
+    for (auto child : node->GetChildren()) stack.push_back(child);
+  }
+
   int max_visited{0};
   AZNode::AZNodePtr max_child{nullptr};
 
@@ -173,9 +280,7 @@ AZNode::AZNodePtr AlphaZero::DrawAction(AZNode::AZNodePtr start) {
     if (child->GetVisitCount() < max_visited) continue;
 
     if (child->GetVisitCount() == max_visited) {
-      double random = static_cast<double>(rand()) / RAND_MAX;
-
-      max_child = random > 0.5 ? max_child : child;
+      if (std::bernoulli_distribution(0.5)(random_generator_)) max_child = child;
     } else {
       max_child = child;
       max_visited = child->GetVisitCount();
@@ -190,31 +295,247 @@ AZNode::AZNodePtr AlphaZero::DrawAction(AZNode::AZNodePtr start) {
 void AlphaZero::Simulate(AZNode::AZNodePtr start) {
   benchmark_.Start("Simulate");
 
+  PhaseTimer timer;
   AZNode::AZNodePtr node = start;
+  int depth = 0;
 
-  while (node->IsExpanded() && !node->IsTerminal()) node = (this->*select_policy_)(node);
+  while (node->IsExpanded() && !node->IsTerminal()) {
+    node = (this->*select_policy_)(node);
+    ++depth;
+  }
 
-  node->Expand();
+  report_.AddDepth(depth);
+  report_.selection_time += timer.Lap();
 
-  torch::Tensor input = GetNNInput(node);
-  std::tuple<torch::Tensor, torch::Tensor> output = network_->forward(input);
+  if (!node->IsExpanded()) {
+    node->Expand();
+    report_.nodes_allocated += static_cast<long>(node->GetChildren().size());
+  }
 
-  torch::Tensor action_values = std::get<0>(output);
-  double state_value = std::get<1>(output)[0].item<double>();
+  report_.expansion_time += timer.Lap();
 
-  for (auto child : node->GetChildren()) child->SetPrior(GetNNOutput(action_values, child));
+  double state_value;
+
+  if (node->IsTerminal()) {
+    state_value = game_->GetStateResult(node->GetState());
+  } else {
+    Evaluation evaluation = Evaluate(std::vector<AZNode::AZNodePtr>{node}).front();
+    std::vector<AZNode::AZNodePtr> children = node->GetChildren();
+
+    for (std::size_t i = 0; i < children.size(); ++i) children[i]->SetPrior(evaluation.priors[i]);
+
+    state_value = evaluation.value;
+  }
 
-  if (node->IsTerminal()) state_value = game_->GetStateResult(node->GetState());
+  report_.evaluation_time += timer.Lap();
 
   // If node's player is black, a positive state_value means moving into this node is bad for white. As backpass (first)
   // adds state_value to the node's action value, it must be negated to discourage white from moving into it.
   (this->*backpass_)(node, -state_value);
 
+  report_.backup_time += timer.Lap();
+
+  benchmark_.End("Simulate");
+}
+
+int AlphaZero::SimulateBatch(AZNode::AZNodePtr start, int simulations) {
+  benchmark_.Start("Simulate");
+
+  PhaseTimer timer;
+
+  // Selection
+
+  std::vector<AZNode::AZNodePtr> leaves;
+  for (int i = 0; i < simulations; ++i) {
+    AZNode::AZNodePtr node = start;
+    int depth = 0;
+
+    while (node->IsExpanded() && !node->IsTerminal()) {
+      node = (this->*select_policy_)(node);
+      ++depth;
+    }
+
+    // Evaluating the same leaf twice adds no information, terminal leaves are not evaluated by the network.
+    if (!node->IsExpanded() && std::find(leaves.begin(), leaves.end(), node) != leaves.end()) break;
+
+    for (AZNode::AZNodePtr n = node; n != nullptr; n = n->GetParent()) n->AddVirtualLoss();
+
+    leaves.push_back(node);
+    report_.AddDepth(depth);
+  }
+
+  report_.selection_time += timer.Lap();
+
+  // Expansion
+
+  std::vector<AZNode::AZNodePtr> evaluated_leaves;
+  for (auto leaf : leaves) {
+    if (leaf->IsExpanded()) continue;
+
+    leaf->Expand();
+    report_.nodes_allocated += static_cast<long>(leaf->GetChildren().size());
+
+    if (!leaf->IsTerminal()) evaluated_leaves.push_back(leaf);
+  }
+
+  report_.expansion_time += timer.Lap();
+
+  // Evaluation
+
+  std::vector<Evaluation> evaluations = Evaluate(evaluated_leaves);
+
+  std::vector<double> values;
+  int index = 0;
+  for (auto leaf : leaves) {
+    if (leaf->IsTerminal()) {
+      values.push_back(game_->GetStateResult(leaf->GetState()));
+      continue;
+    }
+
+    std::vector<AZNode::AZNodePtr> children = leaf->GetChildren();
+    for (std::size_t i = 0; i < children.size(); ++i) children[i]->SetPrior(evaluations[index].priors[i]);
+
+    values.push_back(evaluations[index].value);
+    ++index;
+  }
+
+  report_.evaluation_time += timer.Lap();
+
+  // Backpass (see Simulate)
+
+  for (std::size_t i = 0; i < leaves.size(); ++i) {
+    for (AZNode::AZNodePtr n = leaves[i]; n != nullptr; n = n->GetParent()) n->RemoveVirtualLoss();
+
+    (this->*backpass_)(leaves[i], -values[i]);
+  }
+
+  report_.backup_time += timer.Lap();
+
   benchmark_.End("Simulate");
+
+  return static_cast<int>(leaves.size());
+}
+
+std::tuple<torch::Tensor, torch::Tensor> AlphaZero::Evaluate(torch::Tensor input) {
+  if (inference_server_ == nullptr) {
+    AlphaZeroNet network = GetInferenceNetwork();
+
+    if (simd_network_ != nullptr) {
+      input = input.to(torch::kCPU, torch::kFloat32).contiguous();
+
+      int64_t batch = input.size(0);
+      torch::Tensor action_values = torch::empty(
+          {batch, simd_network_->GetPolicyPlanes(), simd_network_->GetWidth(), simd_network_->GetHeight()});
+      torch::Tensor state_values = torch::empty({batch});
+
+      simd_network_->Forward(input.data_ptr<float>(), static_cast<int>(batch), action_values.data_ptr<float>(),
+                             state_values.data_ptr<float>());
+
+      return std::make_tuple(action_values, state_values);
+    }
+
+    torch::InferenceMode inference_mode;
+
+    return network->forward(input);
+  }
+
+  // Queue every input separately so that the server can batch them with the inputs of other searches.
+  std::vector<std::future<InferenceServer::Output>> futures;
+  for (int64_t i = 0; i < input.size(0); ++i) futures.push_back(inference_server_->Evaluate(input.narrow(0, i, 1)));
+
+  std::vector<torch::Tensor> action_values;
+  std::vector<torch::Tensor> state_values;
+  for (auto &future : futures) {
+    InferenceServer::Output output = future.get();
+
+    action_values.push_back(std::get<0>(output));
+    state_values.push_back(std::get<1>(output));
+  }
+
+  return std::make_tuple(torch::cat(action_values, 0), torch::cat(state_values, 0));
 }
 
+std::vector<AlphaZero::Evaluation> AlphaZero::Evaluate(const std::vector<AZNode::AZNodePtr> &nodes) {
+  std::vector<Evaluation> evaluations(nodes.size());
+  long generation = network_->GetGeneration();
+
+  // The inputs are encoded in the type of the evaluated weights.
+  AlphaZeroNet network = inference_server_ != nullptr ? inference_server_->GetNetwork() : GetInferenceNetwork();
+  torch::ScalarType dtype = network->GetDtype();
+
+  std::vector<std::uint64_t> keys(nodes.size(), 0);
+  std::vector<std::size_t> missed;
+  std::vector<torch::Tensor> inputs;
+
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    if (eval_cache_ != nullptr) {
+      keys[i] = EvalCache::GetKey(nodes[i], time_steps_);
+
+      report_.cache_lookups += 1;
+      if (eval_cache_->Lookup(keys[i], generation, nodes[i]->GetChildCount(), &evaluations[i].value,
+                              &evaluations[i].priors)) {
+        report_.cache_hits += 1;
+        continue;
+      }
+    }
+
+    missed.push_back(i);
+    inputs.push_back(GetNNInput(nodes[i], time_steps_, dtype));
+  }
+
+  if (inputs.empty()) return evaluations;
+
+  std::tuple<torch::Tensor, torch::Tensor> output = Evaluate(torch::cat(inputs, 0));
+
+  torch::Tensor action_values = std::get<0>(output);
+  torch::Tensor state_values = std::get<1>(output).to(torch::kCPU, torch::kFloat64).contiguous();
+
+  for (std::size_t j = 0; j < missed.size(); ++j) {
+    int64_t index = static_cast<int64_t>(j);
+    Evaluation &evaluation = evaluations[missed[j]];
+
+    evaluation.priors = GetNNOutputs(action_values.narrow(0, index, 1), nodes[missed[j]], prior_softmax_);
+    evaluation.value = state_values.data_ptr<double>()[index];
+
+    if (eval_cache_ != nullptr) eval_cache_->Store(keys[missed[j]], generation, evaluation.value, evaluation.priors);
+  }
+
+  return evaluations;
+}
+
+torch::Tensor AlphaZero::GetReplayInputs(int count) { return std::get<0>(replay_memory_->GetBatch(count)); }
+
 void AlphaZero::SetSimulations(int simulations) { simulations_ = simulations; }
 
+void AlphaZero::SetEvalBatchSize(int eval_batch_size) { eval_batch_size_ = std::max(eval_batch_size, 1); }
+
+void AlphaZero::SetPriorSoftmax(bool prior_softmax) { prior_softmax_ = prior_softmax; }
+
+void AlphaZero::SetInferenceDtype(torch::ScalarType inference_dtype) {
+  inference_dtype_ = inference_dtype;
+  inference_network_ = nullptr;
+}
+
+torch::ScalarType AlphaZero::GetInferenceDtype() { return inference_dtype_; }
+
+void AlphaZero::SetQuantization(bool quantization) {
+  quantization_ = quantization;
+  inference_network_ = nullptr;
+}
+
+QuantizationReport AlphaZero::GetQuantizationReport() { return quantization_report_; }
+
+void AlphaZero::SetSimdInference(bool simd_inference) {
+  simd_inference_ = simd_inference;
+  inference_network_ = nullptr;
+}
+
+bool AlphaZero::UsesSimdInference() {
+  GetInferenceNetwork();
+
+  return simd_network_ != nullptr;
+}
+
 void AlphaZero::SetBatchSize(int batch_size) { batch_size_ = batch_size; }
 
 void AlphaZero::SetUseCUDA(bool use_cuda) {
@@ -222,6 +543,23 @@ void AlphaZero::SetUseCUDA(bool use_cuda) {
     network_->to(torch::kCUDA);
   else
     network_->to(torch::kCPU);
+
+  // The inference copy is rebuilt on the new device, the batches are pinned for CUDA only.
+  inference_network_ = nullptr;
+  batch_loader_ = nullptr;
+
+  // The moments of the optimizer follow the parameters.
+  if (optimizer_ != nullptr) {
+    torch::Device device = GetTrainingDevice();
+
+    for (auto &entry : optimizer_->state()) {
+      auto &state = static_cast<torch::optim::AdamParamState &>(*entry.second);
+
+      state.exp_avg(state.exp_avg().to(device));
+      state.exp_avg_sq(state.exp_avg_sq().to(device));
+      if (state.max_exp_avg_sq().defined()) state.max_exp_avg_sq(state.max_exp_avg_sq().to(device));
+    }
+  }
 }
 
 void AlphaZero::SetDiscountFactor(double discount_factor) { discount_factor_ = discount_factor; }
@@ -238,8 +576,42 @@ void AlphaZero::SetSelectPolicy(AZNode::AZNodePtr (AlphaZero::*select_policy)(AZ
 
 void AlphaZero::SetBackpass(void (AlphaZero::*backpass)(AZNode::AZNodePtr, double)) { backpass_ = backpass; }
 
-void AlphaZero::SetAdamLearningRate(double learning_rate) { adam_learning_rate_ = learning_rate; }
-void AlphaZero::SetAdamWeightDecay(double weight_decay) { adam_weight_decay_ = weight_decay; }
+void AlphaZero::SetAdamLearningRate(double learning_rate) {
+  adam_learning_rate_ = learning_rate;
+
+  if (optimizer_ != nullptr) {
+    for (auto &group : optimizer_->param_groups())
+      static_cast<torch::optim::AdamOptions &>(group.options()).lr(learning_rate);
+  }
+}
+
+void AlphaZero::SetAdamWeightDecay(double weight_decay) {
+  adam_weight_decay_ = weight_decay;
+
+  if (optimizer_ != nullptr) {
+    for (auto &group : optimizer_->param_groups())
+      static_cast<torch::optim::AdamOptions &>(group.options()).weight_decay(weight_decay);
+  }
+}
+
+void AlphaZero::SetTrainingSteps(int training_steps) { training_steps_ = std::max(training_steps, 1); }
+
+void AlphaZero::SetGradientAccumulation(int gradient_accumulation) {
+  gradient_accumulation_ = std::max(gradient_accumulation, 1);
+}
+
+std::shared_ptr<torch::optim::Adam> AlphaZero::GetOptimizer() {
+  if (optimizer_ == nullptr) {
+    optimizer_ = std::make_shared<torch::optim::Adam>(
+        network_->parameters(), torch::optim::AdamOptions(adam_learning_rate_).weight_decay(adam_weight_decay_));
+  }
+
+  return optimizer_;
+}
+
+torch::Device AlphaZero::GetTrainingDevice() {
+  return network_->UsesCUDA() && !disable_cuda_update_ ? torch::kCUDA : torch::kCPU;
+}
 
 void AlphaZero::UseDefaultUpdate() {
   SetBackpass(&AlphaZero::AlphaZeroBackpass);
@@ -271,9 +643,9 @@ AZNode::AZNodePtr AlphaZero::SelectMax(AZNode::AZNodePtr node, double (AlphaZero
 
   if (max_children.size() == 1) return max_children.at(0);
 
-  int random = rand() % max_children.size();  // TODO(*): use better random number generator
+  std::uniform_int_distribution<std::size_t> distribution(0, max_children.size() - 1);
 
-  return max_children.at(random);
+  return max_children.at(distribution(random_generator_));
 }
 
 double AlphaZero::PUCTValue(AZNode::AZNodePtr child) {
@@ -281,20 +653,135 @@ double AlphaZero::PUCTValue(AZNode::AZNodePtr child) {
 
   assert(parent != nullptr);
 
-  double exploitation = child->GetMeanActionValue();
+  // Pending evaluations count as losses (see SimulateBatch).
+  int virtual_loss = child->GetVirtualLoss();
+  double visits = static_cast<double>(child->GetVisitCount() + virtual_loss);
+  double parent_visits = static_cast<double>(parent->GetVisitCount() + parent->GetVirtualLoss());
+
+  double exploitation = virtual_loss > 0 ? (child->GetTotalActionValue() - virtual_loss) / visits
+                                         : child->GetMeanActionValue();
   // TODO(*): use exploration rate C(s) = log((1 + node->GetVisitCount +
   // c_base)/c_base) + c_init instead of const. 4
-  double exploration =
-      1.41 * child->GetPrior() * sqrt(parent->GetVisitCount()) / static_cast<double>(child->GetVisitCount() + 1);
+  double exploration = 1.41 * child->GetPrior() * sqrt(parent_visits) / (visits + 1);
   double value = exploitation + exploration;
 
   return value;
 }
 
+namespace {
+
+// Returns the index of the first maximum of the values and sets count to the number of values equal to it, in a single
+// pass. GCC does not vectorize floating-point max reductions without -ffast-math, hence the intrinsics.
+std::size_t FindMaximum(const double *values, std::size_t size, int *count) {
+  double max_value = -DBL_MAX;
+  std::size_t max_index = 0;
+  int max_count = 0;
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  // Maximum, index of its first occurrence and its count per lane. Indices and counts are exact as doubles.
+  __m128d lane_max = _mm_set1_pd(-DBL_MAX);
+  __m128d lane_index = _mm_setzero_pd();
+  __m128d lane_count = _mm_setzero_pd();
+  __m128d index = _mm_set_pd(1, 0);
+  const __m128d one = _mm_set1_pd(1);
+  const __m128d two = _mm_set1_pd(2);
+
+  for (; i + 2 <= size; i += 2) {
+    __m128d value = _mm_loadu_pd(values + i);
+    __m128d greater = _mm_cmpgt_pd(value, lane_max);
+    __m128d equal = _mm_cmpeq_pd(value, lane_max);
+
+    lane_max = _mm_or_pd(_mm_and_pd(greater, value), _mm_andnot_pd(greater, lane_max));
+    lane_index = _mm_or_pd(_mm_and_pd(greater, index), _mm_andnot_pd(greater, lane_index));
+    lane_count = _mm_add_pd(lane_count, _mm_and_pd(equal, one));
+    lane_count = _mm_or_pd(_mm_and_pd(greater, one), _mm_andnot_pd(greater, lane_count));
+
+    index = _mm_add_pd(index, two);
+  }
+
+  double maxima[2], indices[2], counts[2];
+  _mm_storeu_pd(maxima, lane_max);
+  _mm_storeu_pd(indices, lane_index);
+  _mm_storeu_pd(counts, lane_count);
+
+  for (int lane = 0; lane < 2; ++lane) {
+    std::size_t lane_first = static_cast<std::size_t>(indices[lane]);
+    int lane_max_count = static_cast<int>(counts[lane]);
+
+    if (maxima[lane] > max_value) {
+      max_value = maxima[lane];
+      max_index = lane_first;
+      max_count = lane_max_count;
+    } else if (maxima[lane] == max_value && lane_max_count > 0) {
+      max_index = max_count > 0 ? std::min(max_index, lane_first) : lane_first;
+      max_count += lane_max_count;
+    }
+  }
+#endif
+
+  for (; i < size; ++i) {
+    if (values[i] > max_value || max_count == 0) {
+      max_value = values[i];
+      max_index = i;
+      max_count = 1;
+    } else if (values[i] == max_value) {
+      ++max_count;
+    }
+  }
+
+  *count = max_count;
+
+  return max_index;
+}
+
+}  // namespace
+
 AZNode::AZNodePtr AlphaZero::PUCTSelect(AZNode::AZNodePtr node) {
-  AZNode::AZNodePtr max_node = SelectMax(node, &AlphaZero::PUCTValue);
+  std::shared_ptr<EdgeStatistics> edges = node->GetChildStatistics();
+
+  assert(edges != nullptr && node->GetChildCount() > 0);
+
+  std::size_t count = node->GetChildCount();
+  const double *action_values = edges->action_values.data();
+  const double *priors = edges->priors.data();
+  const int *visit_counts = edges->visit_counts.data();
+  const int *virtual_losses = edges->virtual_losses.data();
 
-  return max_node;
+  // Same values as PUCTValue for all children, computed in a branch-free loop the compiler vectorizes. Unvisited
+  // children have no action value, so dividing it by one instead of their visits keeps their exploitation at zero.
+  double parent_visits = static_cast<double>(node->GetVisitCount() + node->GetVirtualLoss());
+  double exploration_factor = sqrt(parent_visits);
+
+  puct_values_.resize(count);
+  double *values = puct_values_.data();
+
+  for (std::size_t i = 0; i < count; ++i) {
+    int visits = visit_counts[i] + virtual_losses[i];
+
+    double exploitation = (action_values[i] - virtual_losses[i]) / static_cast<double>(std::max(visits, 1));
+    double exploration = 1.41 * priors[i] * exploration_factor / static_cast<double>(visits + 1);
+
+    values[i] = exploitation + exploration;
+  }
+
+  int max_count = 0;
+  std::size_t max_index = FindMaximum(values, count, &max_count);
+  double max_value = values[max_index];
+
+  // Break ties randomly (see SelectMax)
+  if (max_count > 1) {
+    int random = std::uniform_int_distribution<int>(0, max_count - 1)(random_generator_);
+
+    for (std::size_t i = max_index; i < count; ++i) {
+      if (values[i] == max_value && random-- == 0) {
+        max_index = i;
+        break;
+      }
+    }
+  }
+
+  return node->GetChild(max_index);
 }
 
 void AlphaZero::AlphaZeroBackpass(AZNode::AZNodePtr start, double state_value) {
@@ -338,47 +825,301 @@ std::shared_ptr<ReplayMemory> AlphaZero::GetReplayMemory() { return replay_memor
 
 AlphaZeroNet AlphaZero::GetNetwork() { return network_; }
 
+void AlphaZero::Save(std::string path) {
+  network_->Save(path);
+  torch::save(*GetOptimizer(), path + "-optimizer.pt");
+}
+
+void AlphaZero::Load(std::string path) {
+  network_->Load(path);
+
+  // Networks saved without the optimizer are trained with a new one.
+  if (std::ifstream(path + "-optimizer.pt").good())
+    torch::load(*GetOptimizer(), path + "-optimizer.pt", GetTrainingDevice());
+  else
+    optimizer_ = nullptr;
+}
+
+AlphaZeroNet AlphaZero::GetInferenceNetwork() {
+  if (!inference_network_ || inference_network_->GetGeneration() != network_->GetGeneration()) {
+    inference_network_ = AlphaZeroNet(network_->PrepareForInference());
+    simd_network_ = nullptr;
+
+    if (simd_inference_ && !network_->UsesCUDA()) {
+      int width = game_->GetOption("board_width");
+      int height = game_->GetOption("board_height");
+
+      // Evaluated instead of the (float32) inference copy, which is kept for the inference server.
+      simd_network_ = SimdNetwork::Create(network_->GetSimdNetworkWeights(width, height));
+    }
+
+    // The SimdNetwork evaluates float32 weights, the quantized and converted copies are only made for libtorch.
+    if (simd_network_ == nullptr) {
+      if (quantization_ && SupportsQuantization() && !network_->UsesCUDA() && replay_memory_->GetSampleCount() > 0) {
+        AlphaZeroNet quantized(QuantizeNetwork(network_, GetReplayInputs(kQuantizationSampleCount)));
+
+        quantization_report_ =
+            CompareNetworks(inference_network_, quantized, GetReplayInputs(kQuantizationSampleCount));
+        inference_network_ = quantized;
+      } else if (inference_dtype_ != torch::kFloat32 &&
+                 SupportsInferenceDtype(inference_dtype_, network_->UsesCUDA())) {
+        inference_network_->to(inference_dtype_);
+      }
+    }
+  }
+
+  return inference_network_;
+}
+
+void AlphaZero::SetInferenceServer(std::shared_ptr<InferenceServer> inference_server) {
+  inference_server_ = inference_server;
+}
+
+std::shared_ptr<InferenceServer> AlphaZero::GetInferenceServer() { return inference_server_; }
+
+void AlphaZero::SetEvalCache(std::shared_ptr<EvalCache> eval_cache) { eval_cache_ = eval_cache; }
+
+std::shared_ptr<EvalCache> AlphaZero::GetEvalCache() { return eval_cache_; }
+
+SearchReport AlphaZero::GetLastReport() { return report_; }
+
+namespace {
+
+// Values of the bits of a byte, used for packing and unpacking the bitmasks of the input planes
+torch::Tensor GetBitValues() { return torch::tensor({1, 2, 4, 8, 16, 32, 64, 128}, torch::kInt64); }
+
+}  // namespace
+
 ReplayMemory::ReplayMemory(int min_size, int max_size) : min_size_{min_size}, max_size_{max_size} {
   random_generator_ = std::default_random_engine(std::random_device()());
 }
 
-int ReplayMemory::GetSampleCount() { return samples_.size(); }
+int ReplayMemory::GetSampleCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
 
-bool ReplayMemory::IsReady() { return GetSampleCount() >= min_size_; }
+  return static_cast<int>(sample_count_);
+}
 
-int ReplayMemory::GetMinSize() { return min_size_; }
+bool ReplayMemory::IsReady() {
+  std::lock_guard<std::mutex> lock(mutex_);
 
-int ReplayMemory::GetMaxSize() { return max_size_; }
+  return sample_count_ >= min_size_;
+}
 
-void ReplayMemory::SetMinSize(int size) { min_size_ = size; }
+int ReplayMemory::GetMinSize() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return min_size_;
+}
 
-void ReplayMemory::SetMaxSize(int size) { max_size_ = size; }
+int ReplayMemory::GetMaxSize() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return max_size_;
+}
+
+void ReplayMemory::SetMinSize(int size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  min_size_ = size;
+}
+
+void ReplayMemory::SetMaxSize(int size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  max_size_ = size;
+
+  if (max_size_ > 0 && GetCapacity() > max_size_) Reallocate(max_size_);
+}
 
 void ReplayMemory::AddSample(torch::Tensor input, torch::Tensor action_values, double state_value) {
-  AddSample(std::make_tuple(input, std::make_tuple(action_values, state_value)));
+  // Encode the sample before locking the storage.
+  torch::Tensor planes = input.to(torch::kCPU, torch::kFloat32).reshape({input.size(1), -1});
+  torch::Tensor mask = planes != 0;
+
+  // The value of each plane, which is either its maximum or its minimum as all other squares are zero.
+  torch::Tensor max_values = planes.amax(1);
+  torch::Tensor plane_values = torch::where(max_values != 0, max_values, planes.amin(1));
+
+  if (!planes.equal(mask * plane_values.unsqueeze(1)))
+    throw std::invalid_argument("Every plane of the input must have a single non-zero value");
+
+  int64_t squares = planes.size(1);
+  int64_t bytes = (squares + 7) / 8;
+
+  torch::Tensor bits = torch::zeros({planes.size(0), bytes * 8}, torch::kInt64);
+  bits.narrow(1, 0, squares).copy_(mask);
+  torch::Tensor plane_masks = (bits.reshape({-1, bytes, 8}) * GetBitValues()).sum(2).to(torch::kUInt8);
+
+  torch::Tensor flat_action_values = action_values.to(torch::kCPU, torch::kFloat32).reshape({-1});
+  torch::Tensor action_indices = flat_action_values.nonzero().reshape({-1});
+  torch::Tensor action_entries = flat_action_values.index_select(0, action_indices);
+  int64_t entries = action_indices.size(0);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!state_values_.defined()) {
+    int64_t capacity = max_size_ > 0 ? std::min(kInitialCapacity, max_size_) : kInitialCapacity;
+
+    input_masks_ = torch::zeros({capacity, planes.size(0), bytes}, torch::kUInt8);
+    input_values_ = torch::zeros({capacity, planes.size(0)}, torch::kFloat32);
+    action_indices_ = torch::zeros({capacity, std::max<int64_t>(entries, 1)}, torch::kInt32);
+    action_values_ = torch::zeros({capacity, std::max<int64_t>(entries, 1)}, torch::kFloat32);
+    state_values_ = torch::zeros({capacity}, torch::kFloat32);
+
+    input_shape_ = input.sizes().vec();
+    action_value_shape_ = action_values.sizes().vec();
+    input_dtype_ = input.scalar_type();
+    action_value_dtype_ = action_values.scalar_type();
+  }
+
+  int64_t capacity = GetCapacity();
+
+  // Grow by doubling until the maximum size is reached, then overwrite the oldest sample.
+  if (sample_count_ == capacity && (max_size_ <= 0 || capacity < max_size_)) {
+    capacity = max_size_ > 0 ? std::min<int64_t>(2 * capacity, max_size_) : 2 * capacity;
+    Reallocate(capacity);
+  }
+
+  if (entries > action_indices_.size(1)) ReserveActionValues(std::max(entries, 2 * action_indices_.size(1)));
+
+  input_masks_[next_index_].copy_(plane_masks);
+  input_values_[next_index_].copy_(plane_values);
+
+  action_indices_[next_index_].zero_();
+  action_values_[next_index_].zero_();
+  action_indices_[next_index_].narrow(0, 0, entries).copy_(action_indices);
+  action_values_[next_index_].narrow(0, 0, entries).copy_(action_entries);
+
+  state_values_[next_index_].fill_(state_value);
+
+  next_index_ = (next_index_ + 1) % capacity;
+  sample_count_ = std::min(sample_count_ + 1, capacity);
 }
 
 void ReplayMemory::AddSample(std::tuple<torch::Tensor, std::tuple<torch::Tensor, double>> sample) {
-  while (max_size_ > 0 && samples_.size() >= static_cast<std::size_t>(max_size_)) samples_.erase(samples_.begin());
+  AddSample(std::get<0>(sample), std::get<0>(std::get<1>(sample)), std::get<1>(std::get<1>(sample)));
+}
+
+int64_t ReplayMemory::GetCapacity() { return state_values_.defined() ? state_values_.size(0) : 0; }
 
-  samples_.push_back(sample);
+std::vector<torch::Tensor *> ReplayMemory::GetStorage() {
+  return {&input_masks_, &input_values_, &action_indices_, &action_values_, &state_values_};
 }
 
-int ReplayMemory::GetRandomSampleIndex() {
-  auto start = samples_.begin();
-  auto end = samples_.end();
+void ReplayMemory::Reallocate(int64_t capacity) {
+  int64_t count = std::min(sample_count_, capacity);
+  // The oldest sample is at next_index_ once the storage is full and at 0 otherwise.
+  int64_t oldest = sample_count_ == GetCapacity() ? next_index_ : 0;
+
+  torch::Tensor indices = (torch::arange(sample_count_ - count, sample_count_) + oldest) % GetCapacity();
+
+  for (torch::Tensor *storage : GetStorage()) {
+    std::vector<int64_t> shape = storage->sizes().vec();
+    shape[0] = capacity;
+
+    torch::Tensor reallocated = torch::zeros(shape, storage->options());
+    reallocated.narrow(0, 0, count).copy_(storage->index_select(0, indices));
+
+    *storage = reallocated;
+  }
+
+  sample_count_ = count;
+  next_index_ = count % capacity;
+}
+
+void ReplayMemory::ReserveActionValues(int64_t entries) {
+  int64_t capacity = GetCapacity();
+  int64_t previous_entries = action_indices_.size(1);
+
+  torch::Tensor action_indices = torch::zeros({capacity, entries}, action_indices_.options());
+  torch::Tensor action_values = torch::zeros({capacity, entries}, action_values_.options());
+
+  action_indices.narrow(1, 0, previous_entries).copy_(action_indices_);
+  action_values.narrow(1, 0, previous_entries).copy_(action_values_);
+
+  action_indices_ = action_indices;
+  action_values_ = action_values;
+}
+
+torch::Tensor ReplayMemory::GetRandomSampleIndices(int count) {
+  if (sample_count_ == 0) throw std::out_of_range("The replay memory is empty");
+
+  // Without wrap-around, only the first sample_count_ indices are used. Otherwise, all of them are.
+  std::uniform_int_distribution<int64_t> dist(0, sample_count_ - 1);
+
+  std::vector<int64_t> indices(static_cast<std::size_t>(count));
+  for (auto &index : indices) index = dist(random_generator_);
+
+  return torch::tensor(indices, torch::kInt64);
+}
+
+void ReplayMemory::Decode(torch::Tensor indices, Batch *batch) {
+  int64_t size = indices.size(0);
+  int64_t planes = input_shape_[1];
+  int64_t squares = std::accumulate(input_shape_.begin() + 2, input_shape_.end(), int64_t{1}, std::multiplies<>());
+  int64_t action_value_count =
+      std::accumulate(action_value_shape_.begin() + 1, action_value_shape_.end(), int64_t{1}, std::multiplies<>());
+
+  // Views of the tensors of the batch, which are written in place.
+  torch::Tensor inputs = std::get<0>(*batch).view({size, planes, squares});
+  torch::Tensor action_values = std::get<1>(*batch).view({size, action_value_count});
+
+  // Unpack the bits of the masks and scale them by the values of their planes.
+  torch::Tensor masks = input_masks_.index_select(0, indices).unsqueeze(3).bitwise_and(GetBitValues()) != 0;
+  torch::Tensor bits = masks.reshape({size, planes, -1}).narrow(2, 0, squares);
+  torch::mul_out(inputs, bits, input_values_.index_select(0, indices).unsqueeze(2));
+
+  // Unused entries add zero to the first action value.
+  action_values.zero_();
+  action_values.scatter_add_(1, action_indices_.index_select(0, indices).to(torch::kInt64),
+                             action_values_.index_select(0, indices).to(action_values.scalar_type()));
+
+  torch::index_select_out(std::get<2>(*batch), state_values_, 0, indices);
+}
+
+ReplayMemory::Sample ReplayMemory::GetSample() {
+  Batch batch = GetBatch(1);
+
+  return std::make_tuple(std::get<0>(batch), std::make_tuple(std::get<1>(batch), std::get<2>(batch).item<double>()));
+}
+
+ReplayMemory::Batch ReplayMemory::GetBatch(int size) {
+  Batch batch = AllocateBatch(size);
+  GetBatch(&batch);
+
+  return batch;
+}
+
+void ReplayMemory::GetBatch(Batch *batch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  Decode(GetRandomSampleIndices(static_cast<int>(std::get<0>(*batch).size(0))), batch);
+}
+
+ReplayMemory::Batch ReplayMemory::AllocateBatch(int size, bool pin_memory) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (sample_count_ == 0) throw std::out_of_range("The replay memory is empty");
 
-  std::uniform_int_distribution<> dist(0, std::distance(start, end) - 1);
+  std::vector<int64_t> input_shape = input_shape_;
+  std::vector<int64_t> action_value_shape = action_value_shape_;
+  input_shape[0] = action_value_shape[0] = size;
 
-  return dist(random_generator_);
+  return std::make_tuple(torch::empty(input_shape, torch::TensorOptions(input_dtype_).pinned_memory(pin_memory)),
+                         torch::empty(action_value_shape,
+                                      torch::TensorOptions(action_value_dtype_).pinned_memory(pin_memory)),
+                         torch::empty({size}, torch::TensorOptions(torch::kFloat32).pinned_memory(pin_memory)));
 }
 
-std::tuple<torch::Tensor, std::tuple<torch::Tensor, double>> ReplayMemory::GetSample() {
-  auto sample = samples_.begin();
+int64_t ReplayMemory::GetStorageSize() {
+  std::lock_guard<std::mutex> lock(mutex_);
 
-  std::advance(sample, GetRandomSampleIndex());
+  int64_t size = 0;
+  for (torch::Tensor *storage : GetStorage())
+    if (storage->defined()) size += storage->numel() * static_cast<int64_t>(storage->element_size());
 
-  return *sample;
+  return size;
 }
 
 }  // namespace aithena
@@ -12,20 +12,33 @@
 #include <torch/torch.h>
 
 #include <memory>
+#include <mutex>
 #include <random>
 #include <tuple>
 #include <vector>
 
+#include "alphazero/eval_cache.h"
+#include "alphazero/inference_server.h"
 #include "alphazero/nn.h"
 #include "alphazero/node.h"
+#include "alphazero/quantization.h"
+#include "benchmark/search_report.h"
 #include "chess/game.h"
 #include "util/dirichlet.h"
 
 namespace aithena {
 
+// Stores the samples generated by self-play. All member functions are thread-safe.
+//
+// The samples are kept in a ring buffer of contiguous tensors, which grows up to the maximum size and then overwrites
+// the oldest samples. They are stored compactly and decoded to dense tensors when a batch is gathered: every plane of
+// the NN input as a bitmask of its non-zero squares and their common value (the planes of GetNNInput are of this
+// form), the action values as the indices and values of their non-zero entries.
 class ReplayMemory {
  public:
   using Sample = std::tuple<torch::Tensor, std::tuple<torch::Tensor, double>>;
+  // NN inputs, action values and state values of a batch of samples
+  using Batch = std::tuple<torch::Tensor, torch::Tensor, torch::Tensor>;
 
   // Size specifies the maximum number of samples to be stored. A value smaller
   // than one specifies that infinitely many samples can be stored.
@@ -37,24 +50,72 @@ class ReplayMemory {
   int GetMinSize();
   int GetMaxSize();
   void SetMinSize(int);
+  // Drops the oldest samples if more samples than the new maximum are stored.
   void SetMaxSize(int);
 
-  // NN input, action values, state value
+  // NN input, action values, state value. Throws std::invalid_argument if a plane of the input has more than one
+  // non-zero value.
   void AddSample(torch::Tensor, torch::Tensor, double);
   void AddSample(Sample);
 
+  // Returns a copy of a random sample. Throws std::out_of_range if the replay memory is empty.
   Sample GetSample();
+  // Returns a batch of random samples (drawn with replacement). The state values are float32. Throws
+  // std::out_of_range if the replay memory is empty.
+  Batch GetBatch(int size);
+  // Gathers a batch of random samples into the tensors of batch, which must be allocated for the size of the batch
+  // (see AllocateBatch).
+  void GetBatch(Batch *batch);
+  // Returns uninitialized tensors for a batch of the given size, in page-locked memory if pin_memory is set (for
+  // faster copies to CUDA). Throws std::out_of_range if the replay memory is empty.
+  Batch AllocateBatch(int size, bool pin_memory = false);
+
+  // Returns the number of bytes allocated for storing the samples.
+  int64_t GetStorageSize();
+
+  // Number of samples the storage is allocated for by the first sample
+  static constexpr int kInitialCapacity = 256;
 
  private:
   int min_size_;
   int max_size_;
-  std::vector<Sample> samples_;
+
+  // Storage of the samples, allocated by the first sample. Without wrap-around, the samples are stored at the indices
+  // [0, sample_count_). Once the maximum size is reached, next_index_ points to the oldest sample.
+  //
+  // Bitmasks (capacity x planes x bytes) and values (capacity x planes) of the input planes
+  torch::Tensor input_masks_;
+  torch::Tensor input_values_;
+  // Indices into the flattened action values and their values (capacity x entries), unused entries are zero
+  torch::Tensor action_indices_;
+  torch::Tensor action_values_;
+  torch::Tensor state_values_;
+  int64_t sample_count_{0};
+  int64_t next_index_{0};
+
+  // Shapes (of a single sample) and types of the decoded tensors
+  std::vector<int64_t> input_shape_;
+  std::vector<int64_t> action_value_shape_;
+  torch::ScalarType input_dtype_{torch::kFloat32};
+  torch::ScalarType action_value_dtype_{torch::kFloat32};
 
   std::default_random_engine random_generator_;
 
-  int GetRandomSampleIndex();
+  std::mutex mutex_;
+
+  int64_t GetCapacity();
+  std::vector<torch::Tensor *> GetStorage();
+  // Moves the newest samples (at most capacity) to a storage of the given capacity in chronological order.
+  void Reallocate(int64_t capacity);
+  // Grows the storage of the action values to at least the given number of entries per sample.
+  void ReserveActionValues(int64_t entries);
+  torch::Tensor GetRandomSampleIndices(int count);
+  // Decodes the samples at the given indices into the tensors of the batch, without allocating the decoded tensors.
+  void Decode(torch::Tensor indices, Batch *batch);
 };
 
+class BatchLoader;
+
 class AlphaZero {
  public:
   // Creates the alphazero interface. game is a pointer to a chess game instance
@@ -70,12 +131,22 @@ class AlphaZero {
 
   // Plays a game against itself and stores the result in the replay memory. Returns whether the network was updated.
   void SelfPlay(chess::State::StatePtr start = nullptr);
-
-  // Samples a batch of samples from the replay memory and updates the neural network with it.
+  // Plays the given number of games against itself on concurrent workers. Each worker searches with its own copy of
+  // this instance, game rules and random number generator. The network is shared and evaluated through the inference
+  // server (a temporary server is used if none is set).
+  void ParallelSelfPlay(int games, int workers, chess::State::StatePtr start = nullptr);
+
+  // Updates the neural network with the configured number of optimizer steps (see SetTrainingSteps), each on a batch of
+  // samples from the replay memory. The state of the optimizer is kept between calls. Throws std::out_of_range if the
+  // replay memory is empty.
   void TrainNetwork();
 
   // Runs a simulation, starting from the given node and backpasses the result.
   void Simulate(AZNode::AZNodePtr);
+  // Runs up to the given number of simulations starting from the given node, evaluating all leaves with a single
+  // forward pass. Virtual losses steer the simulations towards different leaves. Collecting leaves stops early once a
+  // leaf is selected twice. Returns the number of simulations run.
+  int SimulateBatch(AZNode::AZNodePtr, int simulations);
 
   // Evaluate the given state
   double EvaluateState(chess::State::StatePtr);
@@ -85,6 +156,25 @@ class AlphaZero {
   chess::Game::GamePtr GetGame();
 
   void SetSimulations(int);
+  // Sets the number of leaves evaluated per forward pass of the network during the search (1 disables batching).
+  void SetEvalBatchSize(int);
+  // Sets whether the priors of a node's children are normalized with a softmax over the legal moves.
+  void SetPriorSoftmax(bool);
+  // Sets the type of the weights of the inference copy (float32 or bfloat16). Unsupported types fall back to float32
+  // (see SupportsInferenceDtype), training always uses float32.
+  void SetInferenceDtype(torch::ScalarType);
+  torch::ScalarType GetInferenceDtype();
+  // Sets whether the search evaluates an int8 copy of the network (see QuantizeNetwork), calibrated on samples of the
+  // replay memory. The float copy is used as long as the replay memory is empty and on CUDA.
+  void SetQuantization(bool);
+  // Returns the comparison of the last quantized copy with the float copy, made on other samples of the replay memory.
+  QuantizationReport GetQuantizationReport();
+  // Sets whether the search evaluates the network with the SimdNetwork instead of libtorch if no inference server is
+  // set. Takes precedence over the inference type and quantization. libtorch is used on CUDA and for board sizes and
+  // neuron counts without kernels (see SimdNetwork::IsSupported).
+  void SetSimdInference(bool);
+  // Returns whether the search currently evaluates the SimdNetwork.
+  bool UsesSimdInference();
   void SetBatchSize(int);
   void SetUseCUDA(bool);
   void SetDiscountFactor(double);
@@ -94,6 +184,11 @@ class AlphaZero {
   void SetBackpass(void (AlphaZero::*backpass)(AZNode::AZNodePtr, double));
   void SetAdamLearningRate(double);
   void SetAdamWeightDecay(double);
+  // Sets the number of optimizer steps per call to TrainNetwork.
+  void SetTrainingSteps(int);
+  // Sets the number of smaller batches whose gradients are accumulated for one optimizer step, which reduces the memory
+  // needed for large batches. The batch size remains the number of samples per step.
+  void SetGradientAccumulation(int);
 
   void UseDefaultUpdate();
   void UsePowerUCTUpdate(double p = kDefaultPowerUCTP);
@@ -108,14 +203,37 @@ class AlphaZero {
 
   std::shared_ptr<ReplayMemory> GetReplayMemory();
   AlphaZeroNet GetNetwork();
+  // Saves the network (see AlphaZeroNetImpl::Save) and the state of the optimizer to files with the given prefix.
+  void Save(std::string path);
+  // Loads the network and the state of the optimizer if it was saved with the network.
+  void Load(std::string path);
+  // Returns the copy of the network evaluated by the search (see AlphaZeroNetImpl::PrepareForInference), which is
+  // rebuilt once the weights changed.
+  AlphaZeroNet GetInferenceNetwork();
+  // Sets a server evaluating the network inputs of the search, which allows to batch the inputs of concurrent searches.
+  // The server should use the inference copy of the network (see GetInferenceNetwork). Without a server (nullptr), the
+  // inference copy is evaluated directly.
+  void SetInferenceServer(std::shared_ptr<InferenceServer>);
+  std::shared_ptr<InferenceServer> GetInferenceServer();
+  // Sets a cache for the network evaluations of the search, which may be shared between instances using the same
+  // network. Without a cache (nullptr), every evaluation runs the network.
+  void SetEvalCache(std::shared_ptr<EvalCache>);
+  std::shared_ptr<EvalCache> GetEvalCache();
+  // Returns the telemetry of the last call to DrawAction.
+  SearchReport GetLastReport();
 
   static const int kDefaultSimulations = 800;
+  static const int kDefaultEvalBatchSize = 1;
   static const int kDefaultBatchSize = 4096;
   static constexpr double kDefaultDiscountFactor = 0.99;
   static constexpr double kDefaultDirichletNoiseAlpha = 0.3;
   static constexpr double kDefaultPowerUCTP = 100.0;
   static constexpr double kDefaultAdamLearningRate = 1e-4;
   static constexpr double kDefaultAdamWeightDecay = 1e-6;
+  static const int kDefaultTrainingSteps = 1;
+  static const int kDefaultGradientAccumulation = 1;
+  // Number of samples of the replay memory used for calibrating and comparing a quantized copy of the network
+  static const int kQuantizationSampleCount = 128;
 
   BenchmarkSet benchmark_;
 
@@ -125,24 +243,64 @@ class AlphaZero {
   bool disable_cuda_update_{AITHENA_DISABLE_CUDA_UPDATES};
 
   std::shared_ptr<ReplayMemory> replay_memory_{nullptr};
+  // Prepares the batches of TrainNetwork, started by its first call
+  std::shared_ptr<BatchLoader> batch_loader_{nullptr};
   chess::Game::GamePtr game_{nullptr};
   AlphaZeroNet network_{nullptr};
+  AlphaZeroNet inference_network_{nullptr};
+  // Built with the inference copy if SIMD inference is enabled and supported
+  std::shared_ptr<SimdNetwork> simd_network_{nullptr};
+  std::shared_ptr<InferenceServer> inference_server_{nullptr};
+  std::shared_ptr<EvalCache> eval_cache_{nullptr};
   int time_steps_{8};
+  // Source of the Dirichlet noise and of the random tie-breaks, seeded separately for each self-play worker
   std::mt19937 random_generator_;
   dirichlet_distribution<std::mt19937> dirichlet_noise_{{kDefaultDirichletNoiseAlpha}};
+  // Buffer for the PUCT values of a node's children
+  std::vector<double> puct_values_;
+  // Telemetry of the current or last search, updated while simulating
+  SearchReport report_;
 
   // Simulation settings
 
   int simulations_{kDefaultSimulations};
+  int eval_batch_size_{kDefaultEvalBatchSize};
+  bool prior_softmax_{false};
+  torch::ScalarType inference_dtype_{torch::kFloat32};
+  bool quantization_{false};
+  QuantizationReport quantization_report_;
+  bool simd_inference_{false};
   int batch_size_{kDefaultBatchSize};
   double discount_factor_{kDefaultDiscountFactor};
   double poweruct_p_{kDefaultPowerUCTP};
   AZNode::AZNodePtr (AlphaZero::*select_policy_)(AZNode::AZNodePtr) = &AlphaZero::PUCTSelect;
   void (AlphaZero::*backpass_)(AZNode::AZNodePtr, double) = &AlphaZero::AlphaZeroBackpass;
 
+  // Priors of a node's children (in the order of AZNode::GetChildren) and state value of the node
+  struct Evaluation {
+    std::vector<float> priors;
+    double value{0};
+  };
+
+  // Evaluates a batch of network inputs for the search, using the inference server if set.
+  std::tuple<torch::Tensor, torch::Tensor> Evaluate(torch::Tensor input);
+  // Evaluates the given expanded nodes with a single forward pass. Nodes found in the evaluation cache are not passed
+  // to the network, the evaluations of the other nodes are added to the cache.
+  std::vector<Evaluation> Evaluate(const std::vector<AZNode::AZNodePtr> &nodes);
+  // Returns the network inputs of random samples of the replay memory as a batch.
+  torch::Tensor GetReplayInputs(int count);
+
+  // Returns the optimizer of the network, which is created by the first call.
+  std::shared_ptr<torch::optim::Adam> GetOptimizer();
+  // Returns the device the network is trained on.
+  torch::Device GetTrainingDevice();
+
   // Training settings
   double adam_learning_rate_{kDefaultAdamLearningRate};
   double adam_weight_decay_{kDefaultAdamWeightDecay};
+  int training_steps_{kDefaultTrainingSteps};
+  int gradient_accumulation_{kDefaultGradientAccumulation};
+  std::shared_ptr<torch::optim::Adam> optimizer_{nullptr};
 };  // namespace aithena
 
 }  // namespace aithena
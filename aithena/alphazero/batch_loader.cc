@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/batch_loader.h"
+
+#include <chrono>
+#include <memory>
+
+namespace aithena {
+
+BatchLoader::BatchLoader(std::shared_ptr<ReplayMemory> replay_memory, int batch_size, bool pin_memory)
+    : replay_memory_{replay_memory}, batch_size_{batch_size}, pin_memory_{pin_memory} {
+  for (int i = 0; i < kBufferCount; ++i) free_buffers_.push_back(i);
+
+  thread_ = std::thread(&BatchLoader::Run, this);
+}
+
+BatchLoader::~BatchLoader() { Stop(); }
+
+ReplayMemory::Batch BatchLoader::Next() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // The buffer of the previous batch is no longer used.
+  if (current_buffer_ >= 0) {
+    free_buffers_.push_back(current_buffer_);
+    current_buffer_ = -1;
+    condition_.notify_all();
+  }
+
+  if (ready_buffers_.empty()) {
+    ++stall_count_;
+    condition_.wait(lock, [this] { return !ready_buffers_.empty() || exception_ != nullptr; });
+  }
+
+  if (ready_buffers_.empty()) std::rethrow_exception(exception_);
+
+  current_buffer_ = ready_buffers_.front();
+  ready_buffers_.pop_front();
+  ++batch_count_;
+
+  return buffers_[current_buffer_];
+}
+
+void BatchLoader::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!running_) return;
+    running_ = false;
+  }
+
+  condition_.notify_all();
+  thread_.join();
+}
+
+std::shared_ptr<ReplayMemory> BatchLoader::GetReplayMemory() { return replay_memory_; }
+
+int BatchLoader::GetBatchSize() { return batch_size_; }
+
+long BatchLoader::GetBatchCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return batch_count_;
+}
+
+long BatchLoader::GetStallCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return stall_count_;
+}
+
+void BatchLoader::Run() {
+  try {
+    // The shapes of the buffers are only known once the replay memory contains samples.
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      while (running_ && replay_memory_->GetSampleCount() == 0)
+        condition_.wait_for(lock, std::chrono::milliseconds(1));
+
+      if (!running_) return;
+    }
+
+    for (auto &buffer : buffers_) buffer = replay_memory_->AllocateBatch(batch_size_, pin_memory_);
+
+    while (true) {
+      int buffer;
+
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return !running_ || !free_buffers_.empty(); });
+
+        if (!running_) return;
+
+        buffer = free_buffers_.front();
+        free_buffers_.pop_front();
+      }
+
+      // Sampling runs concurrently to training, only the buffer handed out by Next is in use.
+      replay_memory_->GetBatch(&buffers_[buffer]);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_buffers_.push_back(buffer);
+      }
+
+      condition_.notify_all();
+    }
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      exception_ = std::current_exception();
+    }
+
+    condition_.notify_all();
+  }
+}
+
+}  // namespace aithena
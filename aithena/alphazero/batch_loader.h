@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#ifndef AITHENA_ALPHAZERO_BATCH_LOADER_H_
+#define AITHENA_ALPHAZERO_BATCH_LOADER_H_
+
+#include <torch/torch.h>
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "alphazero/alphazero.h"
+
+namespace aithena {
+
+// Prepares training batches of random samples of a replay memory on a worker thread, so that training does not wait
+// for sampling and collation. Batches are gathered into preallocated buffers (page-locked for CUDA if pin_memory is
+// set), of which one is handed out while the worker fills the other.
+//
+// Batches are drawn ahead of their use and do not contain samples added in the meantime. The worker starts with the
+// first sample of the replay memory.
+class BatchLoader {
+ public:
+  // Starts the worker thread.
+  BatchLoader(std::shared_ptr<ReplayMemory>, int batch_size, bool pin_memory = false);
+  // Stops the worker thread, see Stop.
+  ~BatchLoader();
+
+  BatchLoader(const BatchLoader &) = delete;
+  BatchLoader &operator=(const BatchLoader &) = delete;
+
+  // Returns the next batch, waiting for the worker if it is not ready yet. The tensors are reused by the worker after
+  // the next call, they must be copied if they are needed longer. Rethrows exceptions of the worker.
+  ReplayMemory::Batch Next();
+
+  // Stops the worker thread, Next must not be called afterwards.
+  void Stop();
+
+  std::shared_ptr<ReplayMemory> GetReplayMemory();
+  int GetBatchSize();
+
+  // Returns the number of batches returned by Next and the number of those that were not ready in time.
+  long GetBatchCount();
+  long GetStallCount();
+
+  static const int kBufferCount = 2;
+
+ private:
+  // The main loop of the worker thread
+  void Run();
+
+  std::shared_ptr<ReplayMemory> replay_memory_;
+  int batch_size_;
+  bool pin_memory_;
+
+  std::array<ReplayMemory::Batch, kBufferCount> buffers_;
+  // Indices of the buffers that may be filled and of those that are ready, in the order of filling
+  std::deque<int> free_buffers_;
+  std::deque<int> ready_buffers_;
+  // Index of the buffer returned by the last call to Next, -1 if none
+  int current_buffer_{-1};
+  std::exception_ptr exception_{nullptr};
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+
+  bool running_{true};
+  std::thread thread_;
+
+  long batch_count_{0};
+  long stall_count_{0};
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_ALPHAZERO_BATCH_LOADER_H_
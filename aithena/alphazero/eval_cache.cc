@@ -0,0 +1,160 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/eval_cache.h"
+
+#include <algorithm>
+
+#include "chess/game.h"
+#include "chess/piece.h"
+
+namespace aithena {
+
+namespace {
+
+// SplitMix64 finalizer, maps every feature to a pseudo-random 64 bit number (as a table of Zobrist keys would).
+std::uint64_t Mix(std::uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+  return x ^ (x >> 31);
+}
+
+std::uint64_t HashBoard(Board &board) {
+  std::uint64_t hash = 0;
+  std::uint64_t width = static_cast<std::uint64_t>(board.GetWidth());
+  std::uint64_t height = static_cast<std::uint64_t>(board.GetHeight());
+
+  std::uint64_t piece_index = 0;
+  for (auto player : chess::Game::players) {
+    for (auto figure : chess::Game::figures) {
+      for (auto coord : board.GetPlane(chess::make_piece(figure, player)).GetCoords()) {
+        std::uint64_t square = static_cast<std::uint64_t>(coord.x) + static_cast<std::uint64_t>(coord.y) * width;
+
+        hash ^= Mix(piece_index * width * height + square);
+      }
+
+      ++piece_index;
+    }
+  }
+
+  return hash;
+}
+
+}  // namespace
+
+EvalCache::EvalCache(std::size_t capacity, int shards) {
+  std::size_t shard_count = static_cast<std::size_t>(std::max(shards, 1));
+
+  shard_capacity_ = std::max<std::size_t>(capacity / shard_count, 1);
+
+  for (std::size_t i = 0; i < shard_count; ++i) {
+    shards_.push_back(std::make_unique<Shard>());
+    shards_.back()->entries.resize(shard_capacity_);
+  }
+}
+
+std::uint64_t EvalCache::GetKey(AZNode::AZNodePtr node, int time_steps) {
+  chess::State::StatePtr state = node->GetState();
+
+  std::uint64_t key = Mix(static_cast<std::uint64_t>(state->GetPlayer()));
+  key = Mix(key ^ static_cast<std::uint64_t>(state->GetMoveCount()));
+  key = Mix(key ^ static_cast<std::uint64_t>(state->GetNoProgressCount()));
+  key = Mix(key ^ (static_cast<std::uint64_t>(state->GetCastleKing(chess::Player::kWhite)) |
+                   static_cast<std::uint64_t>(state->GetCastleQueen(chess::Player::kWhite)) << 1 |
+                   static_cast<std::uint64_t>(state->GetCastleKing(chess::Player::kBlack)) << 2 |
+                   static_cast<std::uint64_t>(state->GetCastleQueen(chess::Player::kBlack)) << 3));
+  // The square of a pawn that was just pushed by two squares determines whether en-passant captures are legal.
+  key = Mix(key ^ (static_cast<std::uint64_t>(static_cast<std::uint32_t>(state->GetDPushPawnX())) |
+                   static_cast<std::uint64_t>(static_cast<std::uint32_t>(state->GetDPushPawnY())) << 32));
+
+  // Board history, the input of missing time steps is zero (see GetNNInput).
+  for (int i = 0; node != nullptr && i < time_steps; ++i) {
+    key = Mix(key ^ HashBoard(node->GetState()->GetBoard()));
+    key = Mix(key ^ static_cast<std::uint64_t>(node->GetStateRepetitions()));
+
+    node = node->GetParent();
+  }
+
+  return key;
+}
+
+bool EvalCache::Lookup(std::uint64_t key, long generation, std::size_t child_count, double *value,
+                       std::vector<float> *priors) {
+  Shard &shard = GetShard(key);
+  bool hit = false;
+
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry &entry = shard.entries[GetSlot(key)];
+
+    if (entry.key == key && entry.generation == generation && entry.child_count == child_count) {
+      *value = static_cast<double>(entry.value);
+      *priors = entry.priors;
+      hit = true;
+    }
+  }
+
+  ++lookup_count_;
+  if (hit) ++hit_count_;
+
+  return hit;
+}
+
+void EvalCache::Store(std::uint64_t key, long generation, double value, const std::vector<float> &priors) {
+  Shard &shard = GetShard(key);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  Entry &entry = shard.entries[GetSlot(key)];
+
+  entry.key = key;
+  entry.generation = generation;
+  entry.value = static_cast<float>(value);
+  entry.child_count = static_cast<std::uint32_t>(priors.size());
+  // Reuses the memory of the replaced entry's priors.
+  entry.priors.assign(priors.begin(), priors.end());
+}
+
+void EvalCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+
+    for (auto &entry : shard->entries) entry = Entry();
+  }
+
+  lookup_count_ = 0;
+  hit_count_ = 0;
+}
+
+std::size_t EvalCache::GetCapacity() { return shard_capacity_ * shards_.size(); }
+
+std::size_t EvalCache::GetMemoryUsage() {
+  std::size_t memory_usage = sizeof(*this);
+
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+
+    memory_usage += sizeof(Shard) + shard->entries.capacity() * sizeof(Entry);
+    for (auto &entry : shard->entries) memory_usage += entry.priors.capacity() * sizeof(float);
+  }
+
+  return memory_usage;
+}
+
+long EvalCache::GetLookupCount() { return lookup_count_; }
+
+long EvalCache::GetHitCount() { return hit_count_; }
+
+double EvalCache::GetHitRate() {
+  long lookups = lookup_count_;
+
+  return lookups > 0 ? static_cast<double>(hit_count_) / static_cast<double>(lookups) : 0.0;
+}
+
+EvalCache::Shard &EvalCache::GetShard(std::uint64_t key) { return *shards_[key % shards_.size()]; }
+
+std::size_t EvalCache::GetSlot(std::uint64_t key) { return (key / shards_.size()) % shard_capacity_; }
+
+}  // namespace aithena
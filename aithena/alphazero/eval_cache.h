@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#ifndef AITHENA_ALPHAZERO_EVAL_CACHE_H_
+#define AITHENA_ALPHAZERO_EVAL_CACHE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "alphazero/node.h"
+
+namespace aithena {
+
+// Caches neural network evaluations of positions, which are evaluated repeatedly through transpositions, across the
+// searches of consecutive moves and across self-play games. An entry holds the state value and the priors of the legal
+// moves in the order of AZNode::GetChildren.
+//
+// The cache consists of a fixed number of direct-mapped entries, split into shards that are locked independently. A
+// new entry replaces the entry stored in its slot. Entries are tagged with the generation of the network weights (see
+// AlphaZeroNetImpl::GetGeneration) and treated as missing once the weights changed. All member functions are
+// thread-safe.
+class EvalCache {
+ public:
+  explicit EvalCache(std::size_t capacity = kDefaultCapacity, int shards = kDefaultShardCount);
+
+  EvalCache(const EvalCache &) = delete;
+  EvalCache &operator=(const EvalCache &) = delete;
+
+  // Returns a key identifying the network input and the legal moves of the node: the boards and repetitions of the node
+  // and its time_steps - 1 ancestors, the player, the move counters, the castling rights and the en-passant square.
+  static std::uint64_t GetKey(AZNode::AZNodePtr, int time_steps);
+
+  // Copies the state value and priors stored for the key and generation. Returns false if no such entry exists or if
+  // the entry does not hold priors for child_count moves (a key collision).
+  bool Lookup(std::uint64_t key, long generation, std::size_t child_count, double *value, std::vector<float> *priors);
+  void Store(std::uint64_t key, long generation, double value, const std::vector<float> &priors);
+
+  // Removes all entries and resets the statistics.
+  void Clear();
+
+  // Returns the maximum number of entries.
+  std::size_t GetCapacity();
+  // Returns the estimated memory usage of the cache in bytes.
+  std::size_t GetMemoryUsage();
+
+  long GetLookupCount();
+  long GetHitCount();
+  // Returns the share of lookups that found an entry.
+  double GetHitRate();
+
+  static const std::size_t kDefaultCapacity = 1 << 16;
+  static const int kDefaultShardCount = 16;
+
+ private:
+  struct Entry {
+    std::uint64_t key{0};
+    // Generation of the network weights, negative for empty entries
+    long generation{-1};
+    float value{0};
+    // Number of legal moves of the evaluated node
+    std::uint32_t child_count{0};
+    std::vector<float> priors;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Entry> entries;
+  };
+
+  // Returns the shard and the entry of the shard the key maps to.
+  Shard &GetShard(std::uint64_t key);
+  std::size_t GetSlot(std::uint64_t key);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::size_t shard_capacity_;
+
+  std::atomic<long> lookup_count_{0};
+  std::atomic<long> hit_count_{0};
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_ALPHAZERO_EVAL_CACHE_H_
@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/inference_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+
+namespace aithena {
+
+InferenceServer::InferenceServer(AlphaZeroNet net, int batch_size, long max_wait)
+    : network_{net}, batch_size_{std::max(batch_size, 1)}, max_wait_{max_wait} {
+  thread_ = std::thread(&InferenceServer::Run, this);
+}
+
+InferenceServer::~InferenceServer() { Stop(); }
+
+std::future<InferenceServer::Output> InferenceServer::Evaluate(torch::Tensor input) {
+  Request *request = new Request{input, std::promise<Output>()};
+  std::future<Output> output = request->output.get_future();
+
+  queue_.push(request);
+
+  // Only wake the worker thread for the first request, it keeps polling while requests are pending.
+  if (pending_.fetch_add(1) == 0) condition_.notify_one();
+
+  return output;
+}
+
+void InferenceServer::Stop() {
+  if (!running_.exchange(false)) return;
+
+  condition_.notify_one();
+  thread_.join();
+}
+
+bool InferenceServer::IsRunning() { return running_; }
+
+AlphaZeroNet InferenceServer::GetNetwork() { return network_; }
+
+void InferenceServer::SetBatchSize(int batch_size) { batch_size_ = std::max(batch_size, 1); }
+
+int InferenceServer::GetBatchSize() { return batch_size_; }
+
+void InferenceServer::SetMaxWait(long max_wait) { max_wait_ = max_wait; }
+
+long InferenceServer::GetMaxWait() { return max_wait_; }
+
+long InferenceServer::GetRequestCount() { return request_count_; }
+
+long InferenceServer::GetBatchCount() { return batch_count_; }
+
+void InferenceServer::Run() {
+  std::vector<Request *> batch;
+  std::chrono::steady_clock::time_point deadline;
+  Request *request;
+
+  while (true) {
+    while (static_cast<int>(batch.size()) < batch_size_ && queue_.pop(request)) {
+      --pending_;
+
+      if (batch.empty()) deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(max_wait_);
+
+      batch.push_back(request);
+    }
+
+    bool running = running_;
+
+    if (!batch.empty() && (static_cast<int>(batch.size()) >= batch_size_ || !running ||
+                           std::chrono::steady_clock::now() >= deadline)) {
+      Process(batch);
+      batch.clear();
+      continue;
+    }
+
+    if (!running && batch.empty() && pending_ <= 0) break;
+
+    if (!batch.empty()) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // Wait for the next request. A notification may be missed between checking and waiting, which delays the request
+    // by at most the maximum wait time.
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait_for(lock, std::chrono::microseconds(std::max(max_wait_.load(), 1L)),
+                        [this] { return pending_ > 0 || !running_; });
+  }
+}
+
+void InferenceServer::Process(const std::vector<Request *> &batch) {
+  try {
+    std::vector<torch::Tensor> inputs;
+    for (auto request : batch) inputs.push_back(request->input);
+
+    std::tuple<torch::Tensor, torch::Tensor> output;
+    {
+      torch::InferenceMode inference_mode;
+      output = network_->forward(torch::cat(inputs, 0));
+    }
+
+    torch::Tensor action_values = std::get<0>(output);
+    torch::Tensor state_values = std::get<1>(output);
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      int64_t index = static_cast<int64_t>(i);
+      batch[i]->output.set_value(std::make_tuple(action_values.narrow(0, index, 1), state_values.narrow(0, index, 1)));
+    }
+  } catch (...) {
+    for (auto request : batch) {
+      try {
+        request->output.set_exception(std::current_exception());
+      } catch (const std::future_error &) {
+        // The future has already been fulfilled.
+      }
+    }
+  }
+
+  for (auto request : batch) delete request;
+
+  request_count_ += static_cast<long>(batch.size());
+  batch_count_ += 1;
+}
+
+}  // namespace aithena
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#ifndef AITHENA_ALPHAZERO_INFERENCE_SERVER_H_
+#define AITHENA_ALPHAZERO_INFERENCE_SERVER_H_
+
+#include <torch/torch.h>
+
+#include <atomic>
+#include <boost/lockfree/queue.hpp>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "alphazero/nn.h"
+
+namespace aithena {
+
+// Evaluates neural network inputs on behalf of many search threads. Requests are passed through a lock-free queue to a
+// worker thread, which combines them into batches and runs a single forward pass per batch. A batch is evaluated as
+// soon as it is full or the oldest request waited for the maximum wait time.
+//
+// The server does not change the mode of the network. The network must not be trained while the server is running.
+class InferenceServer {
+ public:
+  // Action values (1 x planes x width x height) and state value (1) of a single input.
+  using Output = std::tuple<torch::Tensor, torch::Tensor>;
+
+  // Starts the worker thread. max_wait is given in microseconds.
+  explicit InferenceServer(AlphaZeroNet net, int batch_size = kDefaultBatchSize, long max_wait = kDefaultMaxWait);
+  // Stops the worker thread, see Stop.
+  ~InferenceServer();
+
+  InferenceServer(const InferenceServer &) = delete;
+  InferenceServer &operator=(const InferenceServer &) = delete;
+
+  // Queues a single network input (1 x channels x width x height). The future is fulfilled once its batch has been
+  // evaluated. Must not be called after Stop.
+  std::future<Output> Evaluate(torch::Tensor input);
+
+  // Evaluates all pending requests and stops the worker thread.
+  void Stop();
+  bool IsRunning();
+
+  AlphaZeroNet GetNetwork();
+
+  void SetBatchSize(int);
+  int GetBatchSize();
+  void SetMaxWait(long);
+  long GetMaxWait();
+
+  // Returns the number of requests and batches evaluated so far.
+  long GetRequestCount();
+  long GetBatchCount();
+
+  static const int kDefaultBatchSize = 16;
+  static const long kDefaultMaxWait = 1000;
+
+ private:
+  struct Request {
+    torch::Tensor input;
+    std::promise<Output> output;
+  };
+
+  // The main loop of the worker thread
+  void Run();
+  // Evaluates the requests and fulfils their futures. Deletes the requests.
+  void Process(const std::vector<Request *> &);
+
+  AlphaZeroNet network_;
+
+  std::atomic<int> batch_size_;
+  std::atomic<long> max_wait_;
+
+  boost::lockfree::queue<Request *> queue_{256};
+  // Number of requests in the queue
+  std::atomic<int> pending_{0};
+
+  // Wakes the worker thread while the queue is empty
+  std::mutex mutex_;
+  std::condition_variable condition_;
+
+  std::atomic<bool> running_{true};
+  std::thread thread_;
+
+  std::atomic<long> request_count_{0};
+  std::atomic<long> batch_count_{0};
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_ALPHAZERO_INFERENCE_SERVER_H_
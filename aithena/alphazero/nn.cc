@@ -5,16 +5,105 @@
 #include "alphazero/nn.h"
 
 #include <algorithm>
+#include <array>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
+#include "alphazero/policy_table.h"
 #include "board/board_plane.h"
 #include "chess/game.h"
 #include "chess/util.h"
 
 namespace aithena {
 
+namespace {
+
+// Returns a copy of the convolution with the batch normalization (in eval mode) folded into its weights and bias:
+// bn(conv(x)) = gamma * (W * x + b - mean) / sqrt(var + eps) + beta.
+torch::nn::Conv2d FoldBatchNorm(torch::nn::Conv2d conv, torch::nn::BatchNorm2d bn) {
+  torch::NoGradGuard no_grad;
+
+  torch::nn::Conv2d folded(torch::nn::Conv2dOptions(conv->options).bias(true));
+  folded->to(conv->weight.device());
+
+  torch::Tensor scale = bn->weight / torch::sqrt(bn->running_var + bn->options.eps());
+  torch::Tensor bias = conv->bias.defined() ? conv->bias : torch::zeros_like(bn->running_mean);
+
+  folded->weight.copy_(conv->weight * scale.reshape({-1, 1, 1, 1}));
+  folded->bias.copy_((bias - bn->running_mean) * scale + bn->bias);
+
+  return folded;
+}
+
+// Returns a copy of the layers with every batch normalization following a convolution folded into it.
+torch::nn::Sequential FuseSequential(torch::nn::Sequential sequential) {
+  torch::nn::Sequential fused;
+
+  for (std::size_t i = 0; i < sequential->size(); ++i) {
+    std::shared_ptr<torch::nn::Module> module = sequential->ptr(i);
+    std::shared_ptr<torch::nn::Module> next = i + 1 < sequential->size() ? sequential->ptr(i + 1) : nullptr;
+
+    if (auto conv = std::dynamic_pointer_cast<torch::nn::Conv2dImpl>(module)) {
+      auto bn = std::dynamic_pointer_cast<torch::nn::BatchNorm2dImpl>(next);
+
+      if (bn) {
+        fused->push_back(FoldBatchNorm(torch::nn::Conv2d(conv), torch::nn::BatchNorm2d(bn)));
+        ++i;
+      } else {
+        fused->push_back(torch::nn::Conv2d(std::dynamic_pointer_cast<torch::nn::Conv2dImpl>(conv->clone())));
+      }
+    } else if (auto block = std::dynamic_pointer_cast<ResidualBlockImpl>(module)) {
+      fused->push_back(ResidualBlock(block->Fuse()));
+    } else if (auto linear = std::dynamic_pointer_cast<torch::nn::LinearImpl>(module)) {
+      fused->push_back(torch::nn::Linear(std::dynamic_pointer_cast<torch::nn::LinearImpl>(linear->clone())));
+    } else if (auto relu = std::dynamic_pointer_cast<torch::nn::ReLUImpl>(module)) {
+      // Layers without parameters are shared.
+      fused->push_back(torch::nn::ReLU(relu));
+    } else if (auto tanh = std::dynamic_pointer_cast<torch::nn::TanhImpl>(module)) {
+      fused->push_back(torch::nn::Tanh(tanh));
+    } else if (auto flatten = std::dynamic_pointer_cast<torch::nn::FlattenImpl>(module)) {
+      fused->push_back(torch::nn::Flatten(flatten));
+    } else {
+      throw std::invalid_argument("Cannot prepare layer " + module->name() + " for inference");
+    }
+  }
+
+  return fused;
+}
+
+// Returns the layer of the sequential at the given index, throws std::invalid_argument if it has another type.
+template <class Layer>
+std::shared_ptr<Layer> GetLayer(torch::nn::Sequential sequential, std::size_t index) {
+  auto layer = index < sequential->size() ? std::dynamic_pointer_cast<Layer>(sequential->ptr(index)) : nullptr;
+  if (!layer) throw std::invalid_argument("Unexpected layer " + std::to_string(index) + " of the network");
+
+  return layer;
+}
+
+// Copies the weight and bias of a layer on the CPU.
+SimdNetworkWeights::Layer CopyLayer(torch::Tensor weight, torch::Tensor bias) {
+  weight = weight.to(torch::kCPU, torch::kFloat32).contiguous();
+  bias = bias.to(torch::kCPU, torch::kFloat32).contiguous();
+
+  SimdNetworkWeights::Layer layer;
+  layer.weight.assign(weight.data_ptr<float>(), weight.data_ptr<float>() + weight.numel());
+  layer.bias.assign(bias.data_ptr<float>(), bias.data_ptr<float>() + bias.numel());
+
+  return layer;
+}
+
+}  // namespace
+
 ResidualBlockImpl::ResidualBlockImpl(int index, torch::nn::Conv2dOptions conv_options)
-    : conv1_{conv_options}, conv2_{conv_options}, bn1_{conv_options.out_channels()}, bn2_{conv_options.out_channels()} {
+    : index_{index},
+      conv1_{conv_options},
+      conv2_{conv_options},
+      bn1_{conv_options.out_channels()},
+      bn2_{conv_options.out_channels()} {
   register_module("resblock" + std::to_string(index) + "_conv1", conv1_);
   register_module("resblock" + std::to_string(index) + "_conv2", conv2_);
   register_module("resblock" + std::to_string(index) + "_bn1", bn1_);
@@ -23,17 +112,41 @@ ResidualBlockImpl::ResidualBlockImpl(int index, torch::nn::Conv2dOptions conv_op
   register_module("resblock" + std::to_string(index) + "_relu2", relu2_);
 }
 
+ResidualBlockImpl::ResidualBlockImpl(int index, torch::nn::Conv2d conv1, torch::nn::Conv2d conv2)
+    : index_{index}, conv1_{conv1}, conv2_{conv2} {
+  register_module("resblock" + std::to_string(index) + "_conv1", conv1_);
+  register_module("resblock" + std::to_string(index) + "_conv2", conv2_);
+  register_module("resblock" + std::to_string(index) + "_relu1", relu1_);
+  register_module("resblock" + std::to_string(index) + "_relu2", relu2_);
+}
+
 torch::Tensor ResidualBlockImpl::forward(torch::Tensor x) {
-  torch::Tensor output = relu1_(bn1_(conv1_(x)));
-  output = relu2_(bn2_(conv2_(output)) + x);
+  torch::Tensor output = conv1_(x);
+  if (!bn1_.is_empty()) output = bn1_(output);
+  output = relu1_(output);
 
-  return x;
+  output = conv2_(output);
+  if (!bn2_.is_empty()) output = bn2_(output);
+
+  return relu2_(output + x);
+}
+
+std::shared_ptr<ResidualBlockImpl> ResidualBlockImpl::Fuse() {
+  if (bn1_.is_empty())
+    return std::make_shared<ResidualBlockImpl>(
+        index_, torch::nn::Conv2d(std::dynamic_pointer_cast<torch::nn::Conv2dImpl>(conv1_->clone())),
+        torch::nn::Conv2d(std::dynamic_pointer_cast<torch::nn::Conv2dImpl>(conv2_->clone())));
+
+  return std::make_shared<ResidualBlockImpl>(index_, FoldBatchNorm(conv1_, bn1_), FoldBatchNorm(conv2_, bn2_));
 }
 
 AlphaZeroNetImpl::AlphaZeroNetImpl(chess::Game::GamePtr game, int neuron_count, int residual_layer_count) {
   int width = game->GetOption("board_width");
   int height = game->GetOption("board_height");
 
+  // Build the policy table before the first search.
+  PolicyTable::Get(width, height);
+
   body_ = torch::nn::Sequential(
       // Layer 1 (rectified, batch-normalized convolution)
       torch::nn::Conv2d(
@@ -74,8 +187,19 @@ AlphaZeroNetImpl::AlphaZeroNetImpl(chess::Game::GamePtr game, int neuron_count,
   register_module("value_head", value_head_);
 }
 
+AlphaZeroNetImpl::AlphaZeroNetImpl(torch::nn::Sequential body, torch::nn::Sequential policy_head,
+                                   torch::nn::Sequential value_head, long generation)
+    : body_{body}, policy_head_{policy_head}, value_head_{value_head}, generation_{generation} {
+  register_module("body", body_);
+  register_module("policy_head", policy_head_);
+  register_module("value_head", value_head_);
+}
+
 std::tuple<torch::Tensor, torch::Tensor> AlphaZeroNetImpl::forward(torch::Tensor x, bool keep_device) {
+  torch::ScalarType dtype = GetDtype();
+
   if (UsesCUDA()) x = x.to(torch::kCUDA);
+  if (x.scalar_type() != dtype) x = x.to(dtype);
 
   torch::Tensor body_output = body_->forward(x);
 
@@ -87,11 +211,18 @@ std::tuple<torch::Tensor, torch::Tensor> AlphaZeroNetImpl::forward(torch::Tensor
     state_value = state_value.to(torch::kCPU);
   }
 
+  if (dtype != torch::kFloat32) {
+    action_values = action_values.to(torch::kFloat32);
+    state_value = state_value.to(torch::kFloat32);
+  }
+
   return std::make_tuple(action_values, state_value.reshape({-1}));
 }
 
 bool AlphaZeroNetImpl::UsesCUDA() { return this->parameters()[0].is_cuda(); }
 
+torch::ScalarType AlphaZeroNetImpl::GetDtype() { return this->parameters()[0].scalar_type(); }
+
 void AlphaZeroNetImpl::Save(std::string path) {
   torch::save(body_, path + "-body.pt");
   torch::save(policy_head_, path + "-policy_head.pt");
@@ -102,39 +233,110 @@ void AlphaZeroNetImpl::Load(std::string path) {
   torch::load(body_, path + "-body.pt");
   torch::load(policy_head_, path + "-policy_head.pt");
   torch::load(value_head_, path + "-value_head.pt");
+
+  IncrementGeneration();
 }
 
-torch::Tensor GetNNInput(AZNode::AZNodePtr node, int time_steps) {
+std::shared_ptr<AlphaZeroNetImpl> AlphaZeroNetImpl::PrepareForInference() {
+  torch::NoGradGuard no_grad;
+
+  auto net = std::make_shared<AlphaZeroNetImpl>(FuseSequential(body_), FuseSequential(policy_head_),
+                                                FuseSequential(value_head_), generation_);
+  net->eval();
+
+  for (auto &parameter : net->parameters()) parameter.set_requires_grad(false);
+
+  return net;
+}
+
+SimdNetworkWeights AlphaZeroNetImpl::GetSimdNetworkWeights(int width, int height) {
+  std::shared_ptr<AlphaZeroNetImpl> net = PrepareForInference();
+
+  SimdNetworkWeights weights;
+  weights.width = width;
+  weights.height = height;
+
+  auto input = GetLayer<torch::nn::Conv2dImpl>(net->body_, 0);
+  weights.input_channels = static_cast<int>(input->options.in_channels());
+  weights.channels = static_cast<int>(input->options.out_channels());
+  weights.input = CopyLayer(input->weight, input->bias);
+
+  for (std::size_t i = 1; i < net->body_->size(); ++i) {
+    if (std::dynamic_pointer_cast<torch::nn::ReLUImpl>(net->body_->ptr(i))) continue;
+
+    auto block = GetLayer<ResidualBlockImpl>(net->body_, i);
+    weights.residual.push_back(CopyLayer(block->conv1_->weight, block->conv1_->bias));
+    weights.residual.push_back(CopyLayer(block->conv2_->weight, block->conv2_->bias));
+  }
+
+  auto policy_hidden = GetLayer<torch::nn::Conv2dImpl>(net->policy_head_, 0);
+  auto policy_output = GetLayer<torch::nn::Conv2dImpl>(net->policy_head_, 2);
+  weights.policy_planes = static_cast<int>(policy_output->options.out_channels());
+  weights.policy_hidden = CopyLayer(policy_hidden->weight, policy_hidden->bias);
+  weights.policy_output = CopyLayer(policy_output->weight, policy_output->bias);
+
+  auto value_conv = GetLayer<torch::nn::Conv2dImpl>(net->value_head_, 0);
+  auto value_hidden = GetLayer<torch::nn::LinearImpl>(net->value_head_, 3);
+  auto value_output = GetLayer<torch::nn::LinearImpl>(net->value_head_, 5);
+  weights.value_conv = CopyLayer(value_conv->weight, value_conv->bias);
+  weights.value_hidden = CopyLayer(value_hidden->weight, value_hidden->bias);
+  weights.value_output = CopyLayer(value_output->weight, value_output->bias);
+
+  if (value_hidden->options.in_features() != (width + 2) * (height + 2))
+    throw std::invalid_argument("The network was not made for a board of size " + std::to_string(width) + "x" +
+                                std::to_string(height));
+
+  return weights;
+}
+
+long AlphaZeroNetImpl::GetGeneration() { return generation_; }
+
+void AlphaZeroNetImpl::IncrementGeneration() { ++generation_; }
+
+bool SupportsInferenceDtype(torch::ScalarType dtype, bool cuda) {
+  if (dtype == torch::kFloat32) return true;
+  if (dtype != torch::kBFloat16) return false;
+  if (cuda) return true;
+
+#if defined(__x86_64__) || defined(__i386__)
+  // Checks the OS support of the registers as well.
+  return __builtin_cpu_supports("avx512bf16") || __builtin_cpu_supports("amx-bf16");
+#else
+  return false;
+#endif
+}
+
+torch::Tensor GetNNInput(AZNode::AZNodePtr node, int time_steps, torch::ScalarType dtype) {
   chess::State::StatePtr state = node->GetState();
+  chess::Player player = state->GetPlayer();
   int width = state->GetBoard().GetWidth();
-  int height = state->GetBoard().GetWidth();
+  int height = state->GetBoard().GetHeight();
 
-  torch::Tensor output = torch::empty({0, width, height});
+  // Planes of a time step: one for each piece and two for a one-hot coding of the number of repetitions
+  int step_planes = plane_count + 2;
 
-  // Board history
-  int time_steps_left = time_steps;
-  while (node != nullptr && time_steps_left > 0) {
-    output = torch::cat({output, EncodeNodeState(node, state->GetPlayer())}, 0);
+  // Missing time steps remain zero.
+  torch::Tensor output = torch::zeros({time_steps * step_planes + 7, width, height}, dtype);
 
-    node = node->GetParent();
-    time_steps_left = time_steps_left - 1;
-  }
+  // Board history, the board planes are encoded once per node and perspective.
+  int step = 0;
+  for (AZNode::AZNodePtr n = node; n != nullptr && step < time_steps; n = n->GetParent(), ++step) {
+    int offset = step * step_planes;
+    int repetitions = n->GetStateRepetitions();
+
+    output.narrow(0, offset, plane_count).copy_(n->GetBoardPlanes(player));
 
-  // Add remaining planes (one for each piece and two for a one-hot coding of
-  // the number of repetitions)
-  if (time_steps_left > 0) {
-    torch::Tensor zeros = torch::zeros({time_steps_left * (plane_count + 2), width, height});
-    output = torch::cat({output, zeros}, 0);
+    if (repetitions & 0x1) output[offset + plane_count].fill_(1);
+    if (repetitions & 0x2) output[offset + plane_count + 1].fill_(1);
   }
 
+  int offset = time_steps * step_planes;
+
   // Player colour
-  if (state->GetPlayer() == chess::Player::kWhite)
-    output = torch::cat({output, torch::zeros({1, width, height})}, 0);
-  else
-    output = torch::cat({output, torch::ones({1, width, height})}, 0);
+  if (player == chess::Player::kBlack) output[offset].fill_(1);
 
   // Total move count
-  output = torch::cat({output, torch::full({1, width, height}, state->GetMoveCount())}, 0);
+  output[offset + 1].fill_(state->GetMoveCount());
 
   // Castling
   std::array<int, 4> castle_values = {
@@ -144,57 +346,54 @@ torch::Tensor GetNNInput(AZNode::AZNodePtr node, int time_steps) {
       static_cast<int>(state->GetCastleQueen(chess::Player::kBlack)),
   };
 
-  for (int value : castle_values) output = torch::cat({output, torch::full({1, width, height}, value)}, 0);
+  for (int i = 0; i < 4; ++i) output[offset + 2 + i].fill_(castle_values[i]);
 
   // No progress count
-  output = torch::cat({output, torch::full({1, width, height}, state->GetNoProgressCount())}, 0);
+  output[offset + 6].fill_(state->GetNoProgressCount());
 
   return output.unsqueeze(0);
 }
 
-torch::Tensor EncodeNodeState(AZNode::AZNodePtr node, chess::Player player) {
-  chess::State::StatePtr state = node->GetState();
-  Board board = state->GetBoard();  // Copy board as it may be rotated
+torch::Tensor EncodeBoardPlanes(chess::State::StatePtr state, chess::Player player) {
+  Board &board = state->GetBoard();
   int width = board.GetWidth();
   int height = board.GetHeight();
 
   // Order planes so that the current player is the first player.
   std::array<chess::Player, 2> players = {player, chess::GetOpponent(player)};
 
-  torch::Tensor output = torch::empty({0, width, height});
-  for (auto player : players) {
-    for (auto figure : chess::Game::figures) {
-      torch::Tensor bt = torch::zeros({1, width, height});
-      BoardPlane &b = board.GetPlane(chess::make_piece(figure, player));
+  std::vector<float> planes(static_cast<std::size_t>(plane_count * width * height), 0);
 
-      for (int x = 0; x < width; ++x) {
-        for (int y = 0; y < height; ++y) {
-          if (!b.get(x, y)) continue;
+  int plane = 0;
+  for (auto p : players) {
+    for (auto figure : chess::Game::figures) {
+      for (auto coord : board.GetPlane(chess::make_piece(figure, p)).GetCoords()) {
+        // Rotate board planes towards current player
+        int x = player == chess::Player::kBlack ? width - 1 - coord.x : coord.x;
+        int y = player == chess::Player::kBlack ? height - 1 - coord.y : coord.y;
 
-          bt.index_put_({0, x, y}, 1);
-        }
+        planes[(plane * width + x) * height + y] = 1;
       }
 
-      output = torch::cat({output, bt}, 0);
+      ++plane;
     }
   }
 
-  // Rotate board and board planes towards current player
-  if (player == chess::Player::kBlack) output = output.rot90(1, {1, 2}).rot90(1, {1, 2});
+  return torch::from_blob(planes.data(), {plane_count, width, height}, torch::kFloat32).clone();
+}
 
-  int repetitions = node->GetStateRepetitions();
+torch::Tensor EncodeNodeState(AZNode::AZNodePtr node, chess::Player player) {
+  torch::Tensor board_planes = node->GetBoardPlanes(player);
+  int width = static_cast<int>(board_planes.size(1));
+  int height = static_cast<int>(board_planes.size(2));
 
-  if (repetitions & 0x1)
-    output = torch::cat({output, torch::ones({1, width, height})}, 0);
-  else
-    output = torch::cat({output, torch::zeros({1, width, height})}, 0);
+  torch::Tensor repetition_planes = torch::zeros({2, width, height});
+  int repetitions = node->GetStateRepetitions();
 
-  if (repetitions & 0x2)
-    output = torch::cat({output, torch::ones({1, width, height})}, 0);
-  else
-    output = torch::cat({output, torch::zeros({1, width, height})}, 0);
+  if (repetitions & 0x1) repetition_planes[0].fill_(1);
+  if (repetitions & 0x2) repetition_planes[1].fill_(1);
 
-  return output;
+  return torch::cat({board_planes, repetition_planes}, 0);
 }
 
 int GetNNOutputSize(chess::Game::GamePtr game) {
@@ -211,100 +410,73 @@ int GetNNOutputSize(int width, int height) {
 }
 
 int GetNNOutputPlane(chess::State::StatePtr state) {
-  int selector;  // Return value
-
-  torch::Tensor plane;
-
-  Coord source = state->move_info_->GetFrom();
-  Coord target = state->move_info_->GetTo();
-  Piece piece = state->GetBoard().GetField(target.x, target.y);
-
-  int dx = target.x - source.x;
-  int dy = target.y - source.y;
+  const PolicyTable &table = PolicyTable::Get(state->GetBoard().GetWidth(), state->GetBoard().GetHeight());
 
-  // Rotate towards player that made the move (If it is white's turn, black made the move)
-  if (state->GetPlayer() == chess::Player::kWhite) {
-    dx = state->GetBoard().GetWidth() - dx - 1;
-    dy = state->GetBoard().GetHeight() - dy - 1;
-  }
-
-  // Underpromotion
-  if (state->move_info_->IsPromotion() && piece.figure != static_cast<int>(chess::Figure::kQueen)) {
-    if (piece.figure == static_cast<int>(chess::Figure::kKnight))
-      selector = dx + 1;
-    else if (piece.figure == static_cast<int>(chess::Figure::kBishop))
-      selector = dx + 4;
-    else if (piece.figure == static_cast<int>(chess::Figure::kRook))
-      selector = dx + 7;
-    else
-      assert(false);  // Should never reach here - illegal promotion type
-
-    return selector;
-  }
-
-  chess::MoveInfo::Direction direction = state->move_info_->GetDirection();
+  return table.GetIndex(state) / (table.GetWidth() * table.GetHeight());
+}
 
-  // Rotate towards player that made the move (If it is white's turn, black made the move)
-  if (state->GetPlayer() == chess::Player::kWhite) direction = chess::MoveInfo::GetOppositeDirection(direction);
+torch::Tensor GetNNOutput(AZNode::AZNodePtr node) {
+  Board &board = node->GetState()->GetBoard();
 
-  // Knight move
-  if (direction == chess::MoveInfo::Direction::kSpecial) {
-    selector = kUnderpromotionPlanes;
+  return GetNNOutput(GetSparseNNOutput(node), board.GetWidth(), board.GetHeight());
+}
 
-    if (dx > 0) selector += 4;
+std::vector<std::pair<int64_t, float>> GetSparseNNOutput(AZNode::AZNodePtr node) {
+  chess::State::StatePtr state = node->GetState();
+  const PolicyTable &table = PolicyTable::Get(state->GetBoard().GetWidth(), state->GetBoard().GetHeight());
 
-    if (dy > 0) selector += 2;
+  // The indices are rotated towards the player to move, like the output of the neural net.
+  std::vector<std::pair<int64_t, float>> values;
+  values.reserve(node->GetChildCount());
 
-    if (dy == -1 || dy == 2) selector += 1;
+  for (auto child : node->GetChildren()) {
+    double prior = static_cast<double>(child->GetVisitCount()) / static_cast<double>(node->GetVisitCount());
 
-    return selector;
+    values.emplace_back(table.GetIndex(child->GetState()), static_cast<float>(prior));
   }
 
-  // Queen move
+  return values;
+}
 
-  int distance = state->move_info_->GetDistance();
+torch::Tensor GetNNOutput(const std::vector<std::pair<int64_t, float>> &values, int width, int height) {
+  int planes = PolicyTable::Get(width, height).GetPlaneCount();
+  torch::Tensor output = torch::zeros({1, planes, width, height}, torch::kFloat32);
+  float *data = output.data_ptr<float>();
 
-  selector = kSpecialPlanes + (distance - 1) * (static_cast<int>(chess::MoveInfo::Direction::kCount) - 1) +
-             static_cast<int>(direction);
+  for (const auto &value : values) data[value.first] = value.second;
 
-  return selector;
+  return output;
 }
 
-torch::Tensor GetNNOutput(AZNode::AZNodePtr node) {
-  chess::State::StatePtr state = node->GetState();
-  int width = state->GetBoard().GetWidth();
-  int height = state->GetBoard().GetHeight();
-
-  torch::Tensor tensor = torch::zeros({1, GetNNOutputSize(width, height), width, height});
-
-  if (node->GetChildren().size() == 0) return tensor;
+double GetNNOutput(torch::Tensor tensor, AZNode::AZNodePtr node) {
+  return tensor[0].reshape({-1})[GetNNOutputIndex(node)].item<double>();
+}
 
-  for (auto child : node->GetChildren()) {
-    Coord source = child->GetState()->move_info_->GetFrom();
-    double prior = static_cast<double>(child->GetVisitCount()) / static_cast<double>(node->GetVisitCount());
+int64_t GetNNOutputIndex(AZNode::AZNodePtr node) {
+  chess::State::StatePtr state = node->GetState();
 
-    tensor.index_put_({0, GetNNOutputPlane(child->GetState()), source.x, source.y}, prior);
-  }
+  return PolicyTable::Get(state->GetBoard().GetWidth(), state->GetBoard().GetHeight()).GetIndex(state);
+}
 
-  // Rotate board towards player
-  if (state->GetPlayer() == chess::Player::kBlack) tensor = tensor.rot90(1, {2, 3}).rot90(1, {2, 3});
+std::vector<float> GetNNOutputs(torch::Tensor tensor, AZNode::AZNodePtr node, bool softmax) {
+  std::vector<AZNode::AZNodePtr> children = node->GetChildren();
 
-  return tensor;
-}
+  if (children.empty()) return {};
 
-double GetNNOutput(torch::Tensor tensor, AZNode::AZNodePtr node) {
-  int selector = GetNNOutputPlane(node->GetState());
-  Coord source = node->GetState()->move_info_->GetFrom();
+  std::vector<int64_t> indices;
+  indices.reserve(children.size());
+  for (auto child : children) indices.push_back(GetNNOutputIndex(child));
 
-  torch::Tensor action_tensor = tensor[0][selector];
+  torch::Tensor index =
+      torch::from_blob(indices.data(), {static_cast<int64_t>(indices.size())}, torch::kInt64).to(tensor.device());
+  torch::Tensor values = tensor[0].reshape({-1}).index_select(0, index);
 
-  // Rotate board towards player (if node's player is white, the move was made by black -> so rotate)
-  if (node->GetState()->GetPlayer() == chess::Player::kWhite)
-    action_tensor = action_tensor.rot90(1, {0, 1}).rot90(1, {0, 1});
+  if (softmax) values = torch::softmax(values, 0);
 
-  double value = action_tensor[source.x][source.y].item<double>();
+  // Single transfer to the CPU
+  values = values.to(torch::kCPU, torch::kFloat32).contiguous();
 
-  return value;
+  return std::vector<float>(values.data_ptr<float>(), values.data_ptr<float>() + values.numel());
 }
 
 }  // namespace aithena
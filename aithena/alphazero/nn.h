@@ -5,20 +5,31 @@
 #ifndef AITHENA_ALPHAZERO_NN_H_
 #define AITHENA_ALPHAZERO_NN_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "alphazero/node.h"
+#include "alphazero/simd_network.h"
 #include "chess/game.h"
 
 namespace aithena {
 
 struct ResidualBlockImpl : torch::nn::Module {
   ResidualBlockImpl(int index, torch::nn::Conv2dOptions conv_options);
+  // Creates a block without batch normalization from convolutions that have it folded in (see Fuse).
+  ResidualBlockImpl(int index, torch::nn::Conv2d conv1, torch::nn::Conv2d conv2);
 
   torch::Tensor forward(torch::Tensor x);
 
+  // Returns a copy of the block with the batch normalizations folded into the convolutions.
+  std::shared_ptr<ResidualBlockImpl> Fuse();
+
+  int index_;
+
   torch::nn::Conv2d conv1_{nullptr};
   torch::nn::BatchNorm2d bn1_{nullptr};
   torch::nn::ReLU relu1_{};
@@ -31,21 +42,46 @@ TORCH_MODULE(ResidualBlock);
 
 struct AlphaZeroNetImpl : torch::nn::Module {
   explicit AlphaZeroNetImpl(chess::Game::GamePtr game, int neuron_count = 256, int residual_layer_count = 19);
+  // Creates a network from its layers, e.g. a copy of the weights of the given generation prepared for inference.
+  AlphaZeroNetImpl(torch::nn::Sequential body, torch::nn::Sequential policy_head, torch::nn::Sequential value_head,
+                   long generation = 0);
 
-  // Returns the action value tensor and a state value double.
+  // Returns the action value tensor and a state value double. The input is converted to the type of the weights, the
+  // outputs are float32.
   std::tuple<torch::Tensor, torch::Tensor> forward(torch::Tensor, bool keep_device = false);
 
   void Save(std::string path);
   void Load(std::string path);
 
+  // Returns the generation of the weights, which is increased whenever the weights change (see IncrementGeneration).
+  // Cached evaluations of older generations are stale.
+  long GetGeneration();
+  // Must be called after updating the weights.
+  void IncrementGeneration();
+
   // Returns whether the NN uses CUDA
   bool UsesCUDA();
+  // Returns the type of the weights, float32 unless an inference copy was converted (see SupportsInferenceDtype).
+  torch::ScalarType GetDtype();
+
+  // Returns a copy of the network for evaluation only: batch normalizations use their running statistics and are
+  // folded into the preceding convolutions, the copy is in eval mode and its parameters do not require gradients. The
+  // copy has the generation of the weights it was made from and does not follow later updates. Evaluate it under
+  // torch::InferenceMode.
+  std::shared_ptr<AlphaZeroNetImpl> PrepareForInference();
+
+  // Returns the weights of an inference copy of the network for the SimdNetwork of a board with the given size. Throws
+  // std::invalid_argument if the layers differ from those of AlphaZeroNetImpl.
+  SimdNetworkWeights GetSimdNetworkWeights(int width, int height);
 
   torch::nn::Sequential body_{nullptr};
   torch::nn::Sequential policy_head_{nullptr};
   torch::nn::Sequential value_head_{nullptr};
 
   static const int kInputSize{119};
+
+ private:
+  long generation_{0};
 };
 
 TORCH_MODULE(AlphaZeroNet);
@@ -55,22 +91,39 @@ static const int kKnightPlanes = 8;
 static const int kSpecialPlanes = kKnightPlanes + kUnderpromotionPlanes;
 static const int plane_count = (chess::Game::player_count * chess::Game::figure_count);
 
+// Returns whether inference copies of the network may use the given type for their weights. bfloat16 requires native
+// instructions (AVX512-BF16 or AMX-BF16, used by the oneDNN kernels) on the CPU, emulating them is slower than float32.
+bool SupportsInferenceDtype(torch::ScalarType, bool cuda = false);
+
 int GetNNInputSize(chess::Game::GamePtr);
 int GetNNOutputSize(chess::Game::GamePtr);
 int GetNNOutputSize(int width, int height);
 int GetNNOutputPlane(chess::State::StatePtr state);
 
+// Generates the board planes (one for each piece) of a state from the perspective of some player.
+torch::Tensor EncodeBoardPlanes(chess::State::StatePtr, chess::Player player);
 // Generates the tensor for a AZNode's state from the perspective of some player.
 torch::Tensor EncodeNodeState(AZNode::AZNodePtr, chess::Player player);
 
-// Generates the neural network input tensor given a AZNode. time_steps specifies the history length of moves.
-torch::Tensor GetNNInput(AZNode::AZNodePtr, int time_steps = 8);
+// Generates the neural network input tensor given a AZNode. time_steps specifies the history length of moves, dtype the
+// type of the tensor (the type of the weights avoids a conversion in the forward pass).
+torch::Tensor GetNNInput(AZNode::AZNodePtr, int time_steps = 8, torch::ScalarType dtype = torch::kFloat32);
 
 // Returns the node's value selected from the output tensor of the neural net.
 double GetNNOutput(torch::Tensor, AZNode::AZNodePtr);
+// Returns the index of the node's value in the flattened output tensor (planes x width x height) of the neural net.
+int64_t GetNNOutputIndex(AZNode::AZNodePtr);
+// Returns the values of all children of the node (in the order of AZNode::GetChildren), gathered from the output tensor
+// of the neural net with a single index operation. If softmax is set, the values are normalized over the children.
+std::vector<float> GetNNOutputs(torch::Tensor, AZNode::AZNodePtr node, bool softmax = false);
 
 // Returns the tensor expected as output for a given node.
 torch::Tensor GetNNOutput(AZNode::AZNodePtr node);
+// Returns the non-zero values of the expected output of a node (the visit shares of its children) with their indices in
+// the flattened output tensor.
+std::vector<std::pair<int64_t, float>> GetSparseNNOutput(AZNode::AZNodePtr node);
+// Returns the output tensor (1 x planes x width x height) holding the given values at their indices.
+torch::Tensor GetNNOutput(const std::vector<std::pair<int64_t, float>> &values, int width, int height);
 
 }  // namespace aithena
 
@@ -4,13 +4,24 @@
 
 #include "alphazero/node.h"
 
+#include <cstdint>
+
 #include "alphazero/nn.h"
 
 namespace aithena {
 
-AZNode::AZNode(chess::Game::GamePtr game, chess::State::StatePtr state, AZNode::AZNodePtr parent) : game_{game} {
+AZNode::AZNode(chess::Game::GamePtr game, chess::State::StatePtr state, AZNode::AZNodePtr parent,
+               std::shared_ptr<EdgeStatistics> edges, std::size_t edge_index)
+    : game_{game}, edge_index_{edge_index} {
   state_ = state;
   parent_ = parent;
+
+  if (edges == nullptr) {
+    edges_ = std::make_shared<EdgeStatistics>();
+    edge_index_ = 0;
+  } else {
+    edges_ = edges;
+  }
 }
 
 chess::State::StatePtr AZNode::GetState() { return state_; }
@@ -19,47 +30,71 @@ AZNode::AZNodePtr AZNode::GetParent() { return parent_.lock(); }
 
 std::vector<AZNode::AZNodePtr> AZNode::GetChildren() { return children_; }
 
+AZNode::AZNodePtr AZNode::GetChild(std::size_t index) { return children_[index]; }
+
+std::size_t AZNode::GetChildCount() { return children_.size(); }
+
+std::shared_ptr<EdgeStatistics> AZNode::GetChildStatistics() { return child_edges_; }
+
 void AZNode::SetParent(AZNodePtr parent) { parent_ = parent; }
 
 int AZNode::GetStateRepetitions() {
   int repetitions = 0;
 
+  // Captures and pawn moves reset the no progress count and cannot be undone, so no state before the last of them
+  // equals the current state.
+  int distance = state_->GetNoProgressCount() + 1;
+
   AZNode::AZNodePtr current_node = GetParent();
-  while (current_node != nullptr) {
+  while (current_node != nullptr && distance > 0) {
     if (*current_node->GetState() == *GetState()) ++repetitions;
 
     current_node = current_node->GetParent();
+    --distance;
   }
 
   return repetitions;
 }
 
-void AZNode::SetPrior(double prior) { prior_ = prior; }
+torch::Tensor AZNode::GetBoardPlanes(chess::Player player) {
+  torch::Tensor &planes = board_planes_[static_cast<int>(player)];
+
+  if (!planes.defined()) planes = EncodeBoardPlanes(state_, player);
+
+  return planes;
+}
+
+void AZNode::SetPrior(double prior) { edges_->priors[edge_index_] = prior; }
 
 void AZNode::Update(double value, bool override) {
-  ++visit_count_;
+  int visit_count = ++edges_->visit_counts[edge_index_];
 
   if (override)
-    action_value_ = static_cast<double>(visit_count_) * value;
+    edges_->action_values[edge_index_] = static_cast<double>(visit_count) * value;
   else
-    action_value_ += value;
+    edges_->action_values[edge_index_] += value;
 }
 
 void AZNode::Expand() {
   if (expanded_) return;
 
-  AZNodePtr node;
-
   auto moves = game_->GetLegalActions(state_);
-  for (auto move : moves) {
-    node = std::make_shared<AZNode>(game_, move, shared_from_this());
 
-    children_.push_back(node);
-  }
+  child_edges_ = std::make_shared<EdgeStatistics>(moves.size());
+  children_.reserve(moves.size());
+
+  for (std::size_t i = 0; i < moves.size(); ++i)
+    children_.push_back(std::make_shared<AZNode>(game_, moves[i], shared_from_this(), child_edges_, i));
 
   expanded_ = true;
 }
 
+void AZNode::Collapse() {
+  std::vector<AZNodePtr>().swap(children_);
+  child_edges_ = nullptr;
+  expanded_ = false;
+}
+
 bool AZNode::IsExpanded() { return expanded_; }
 
 bool AZNode::IsTerminal() {
@@ -69,15 +104,44 @@ bool AZNode::IsTerminal() {
 }
 
 double AZNode::GetMeanActionValue() {
-  if (visit_count_ <= 0) return 0;
+  int visit_count = edges_->visit_counts[edge_index_];
 
-  return action_value_ / static_cast<double>(visit_count_);
+  if (visit_count <= 0) return 0;
+
+  return edges_->action_values[edge_index_] / static_cast<double>(visit_count);
 }
 
-double AZNode::GetPrior() { return prior_; }
+double AZNode::GetPrior() { return edges_->priors[edge_index_]; }
+
+double AZNode::GetTotalActionValue() { return edges_->action_values[edge_index_]; }
+
+int AZNode::GetVisitCount() { return edges_->visit_counts[edge_index_]; }
+
+void AZNode::AddVirtualLoss() { ++edges_->virtual_losses[edge_index_]; }
+
+void AZNode::RemoveVirtualLoss() { --edges_->virtual_losses[edge_index_]; }
 
-double AZNode::GetTotalActionValue() { return action_value_; }
+int AZNode::GetVirtualLoss() { return edges_->virtual_losses[edge_index_]; }
 
-int AZNode::GetVisitCount() { return visit_count_; }
+std::size_t AZNode::GetMemoryUsage() {
+  Board &board = state_->GetBoard();
+
+  // Same estimate as MCTSNode::GetMemoryUsage
+  std::size_t plane_size = sizeof(BoardPlane) + (board.GetWidth() * board.GetHeight() + 63) / 64 * sizeof(uint64_t);
+  std::size_t state_size = sizeof(chess::State) + 2 * board.GetFigureCount() * plane_size;
+  if (state_->move_info_ != nullptr) state_size += sizeof(chess::MoveInfo);
+
+  std::size_t planes_size = 0;
+  for (auto &planes : board_planes_) {
+    if (planes.defined()) planes_size += static_cast<std::size_t>(planes.numel()) * sizeof(float);
+  }
+
+  // The statistics of the edges to the children are accounted to the parent.
+  std::size_t edges_size = 0;
+  if (child_edges_ != nullptr)
+    edges_size = sizeof(EdgeStatistics) + children_.size() * (2 * sizeof(double) + 2 * sizeof(int));
+
+  return sizeof(AZNode) + state_size + planes_size + edges_size + children_.capacity() * sizeof(AZNodePtr);
+}
 
 }  // namespace aithena
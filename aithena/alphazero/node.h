@@ -7,6 +7,8 @@
 
 #include <torch/torch.h>
 
+#include <array>
+#include <cstddef>
 #include <memory>
 #include <vector>
 
@@ -14,18 +16,44 @@
 
 namespace aithena {
 
+// Statistics of the edges from a node to its children, stored as arrays indexed by child so that selection evaluates
+// all children in a single pass over contiguous memory (see AlphaZero::PUCTSelect). The arrays are shared by the
+// children, which keeps the statistics of a child alive when its parent is released.
+struct EdgeStatistics {
+  explicit EdgeStatistics(std::size_t size = 1)
+      : action_values(size, 0), priors(size, 0), visit_counts(size, 0), virtual_losses(size, 0) {}
+
+  // Sum of the values backpassed through the edge
+  std::vector<double> action_values;
+  std::vector<double> priors;
+  std::vector<int> visit_counts;
+  std::vector<int> virtual_losses;
+};
+
 class AZNode : public std::enable_shared_from_this<AZNode> {
  public:
   using AZNodePtr = std::shared_ptr<AZNode>;
 
-  AZNode(chess::Game::GamePtr game, chess::State::StatePtr state, AZNodePtr parent = nullptr);
+  // Creates a node storing its edge statistics at the given index of the given statistics. By default, the node gets
+  // statistics of its own.
+  AZNode(chess::Game::GamePtr game, chess::State::StatePtr state, AZNodePtr parent = nullptr,
+         std::shared_ptr<EdgeStatistics> edges = nullptr, std::size_t edge_index = 0);
 
   chess::State::StatePtr GetState();
   AZNodePtr GetParent();
   std::vector<AZNodePtr> GetChildren();
+  AZNodePtr GetChild(std::size_t index);
+  std::size_t GetChildCount();
+  // Returns the statistics of the edges to the children (nullptr if the node is not expanded).
+  std::shared_ptr<EdgeStatistics> GetChildStatistics();
   void SetParent(AZNodePtr);
 
+  // Returns how often the node's state occurred before in its history.
   int GetStateRepetitions();
+  // Returns the board planes of the node's state from the perspective of the given player (see EncodeBoardPlanes). The
+  // planes are encoded on the first call and kept by the node, as every node is part of the history of its
+  // descendants' network inputs.
+  torch::Tensor GetBoardPlanes(chess::Player);
 
   void SetPrior(double);
   // Updated the node's action value with the given value. If override is set to false, it is incorporated into the
@@ -33,6 +61,9 @@ class AZNode : public std::enable_shared_from_this<AZNode> {
   void Update(double, bool override = false);
 
   void Expand();
+  // Releases all children and the statistics of their edges. Children still referenced elsewhere keep their statistics.
+  // The node is expanded again once the search reaches it.
+  void Collapse();
   bool IsExpanded();
 
   bool IsTerminal();
@@ -42,6 +73,15 @@ class AZNode : public std::enable_shared_from_this<AZNode> {
   double GetTotalActionValue();
   int GetVisitCount();
 
+  // Virtual losses mark simulations that passed through the node but are still waiting for their evaluation (see
+  // AlphaZero::SetEvalBatchSize). Each virtual loss counts as a visit with a loss.
+  void AddVirtualLoss();
+  void RemoveVirtualLoss();
+  int GetVirtualLoss();
+
+  // Returns the estimated memory usage of the node in bytes, excluding its children.
+  std::size_t GetMemoryUsage();
+
  private:
   // The game rules for chess
   chess::Game::GamePtr game_;
@@ -53,12 +93,14 @@ class AZNode : public std::enable_shared_from_this<AZNode> {
   chess::State::StatePtr state_;
   // Whether the node has been expanded
   bool expanded_{false};
-
-  // Edge statistics (in relation to the parent node)
-
-  double action_value_{0};
-  double prior_{0};
-  int visit_count_{0};
+  // Encoded board planes, indexed by the player of the perspective
+  std::array<torch::Tensor, 2> board_planes_;
+
+  // Edge statistics (in relation to the parent node), stored in the parent's child statistics
+  std::shared_ptr<EdgeStatistics> edges_;
+  std::size_t edge_index_;
+  // Statistics of the edges to the children
+  std::shared_ptr<EdgeStatistics> child_edges_{nullptr};
 };
 
 }  // namespace aithena
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/policy_table.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "alphazero/nn.h"
+#include "chess/game.h"
+
+namespace aithena {
+
+namespace {
+
+const int kPromotionCount = 4;
+
+// Returns the slot of a promotion in the table, queen promotions are encoded as regular moves.
+int GetPromotionSlot(chess::Figure promotion) {
+  switch (promotion) {
+    case chess::Figure::kKnight:
+      return 1;
+    case chess::Figure::kBishop:
+      return 2;
+    case chess::Figure::kRook:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
+// Selects the output plane of a move. player is the player to move after the move. Note that the rotation of the
+// coordinate differences maps dx to width - dx - 1 rather than -dx, which is kept as the networks were trained with it.
+int ComputePlane(Coord source, Coord target, int promotion_slot, chess::Player player, int width, int height) {
+  int dx = target.x - source.x;
+  int dy = target.y - source.y;
+
+  // Rotate towards player that made the move (If it is white's turn, black made the move)
+  if (player == chess::Player::kWhite) {
+    dx = width - dx - 1;
+    dy = height - dy - 1;
+  }
+
+  // Underpromotion (knight, bishop and rook planes follow each other)
+  if (promotion_slot > 0) return dx + 1 + 3 * (promotion_slot - 1);
+
+  chess::MoveInfo move_info(source, target, 0, 0, 0);
+  chess::MoveInfo::Direction direction = move_info.GetDirection();
+
+  if (player == chess::Player::kWhite) direction = chess::MoveInfo::GetOppositeDirection(direction);
+
+  // Knight move
+  if (direction == chess::MoveInfo::Direction::kSpecial) {
+    int selector = kUnderpromotionPlanes;
+
+    if (dx > 0) selector += 4;
+
+    if (dy > 0) selector += 2;
+
+    if (dy == -1 || dy == 2) selector += 1;
+
+    return selector;
+  }
+
+  // Queen move
+  return kSpecialPlanes + (move_info.GetDistance() - 1) * (static_cast<int>(chess::MoveInfo::Direction::kCount) - 1) +
+         static_cast<int>(direction);
+}
+
+}  // namespace
+
+const PolicyTable &PolicyTable::Get(int width, int height) {
+  // Searches run on a single geometry, which saves locking for all but the first lookup of a thread.
+  thread_local const PolicyTable *last_table = nullptr;
+
+  if (last_table != nullptr && last_table->width_ == width && last_table->height_ == height) return *last_table;
+
+  static std::mutex mutex;
+  static std::map<std::pair<int, int>, std::unique_ptr<PolicyTable>> tables;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::unique_ptr<PolicyTable> &table = tables[std::make_pair(width, height)];
+  if (table == nullptr) table.reset(new PolicyTable(width, height));
+
+  last_table = table.get();
+
+  return *table;
+}
+
+PolicyTable::PolicyTable(int width, int height)
+    : width_{width}, height_{height}, plane_count_{GetNNOutputSize(width, height)} {
+  int squares = width * height;
+
+  indices_.resize(static_cast<std::size_t>(chess::Game::player_count * kPromotionCount * squares * squares));
+
+  std::size_t i = 0;
+  for (auto player : chess::Game::players) {
+    // Rotation is applied if black made the move (it is white's turn afterwards).
+    chess::Player next_player = chess::GetOpponent(player);
+
+    for (int promotion_slot = 0; promotion_slot < kPromotionCount; ++promotion_slot) {
+      for (int from = 0; from < squares; ++from) {
+        Coord source{from % width, from / width};
+
+        int x = player == chess::Player::kBlack ? width - 1 - source.x : source.x;
+        int y = player == chess::Player::kBlack ? height - 1 - source.y : source.y;
+
+        for (int to = 0; to < squares; ++to) {
+          Coord target{to % width, to / width};
+          int plane = ComputePlane(source, target, promotion_slot, next_player, width, height);
+
+          indices_[i++] = (plane * width + x) * height + y;
+        }
+      }
+    }
+  }
+}
+
+int PolicyTable::GetIndex(chess::Player player, Coord from, Coord to, chess::Figure promotion) const {
+  int squares = width_ * height_;
+  int slot = static_cast<int>(player) * kPromotionCount + GetPromotionSlot(promotion);
+
+  return indices_[static_cast<std::size_t>((slot * squares + from.x + from.y * width_) * squares + to.x +
+                                           to.y * width_)];
+}
+
+int PolicyTable::GetIndex(chess::State::StatePtr state) const {
+  Coord from = state->move_info_->GetFrom();
+  Coord to = state->move_info_->GetTo();
+
+  // The promoted figure is found on the target square.
+  chess::Figure promotion = chess::Figure::kInvalid;
+  if (state->move_info_->IsPromotion())
+    promotion = static_cast<chess::Figure>(state->GetBoard().GetField(to.x, to.y).figure);
+
+  return GetIndex(state->GetOpponent(), from, to, promotion);
+}
+
+int PolicyTable::GetWidth() const { return width_; }
+
+int PolicyTable::GetHeight() const { return height_; }
+
+int PolicyTable::GetPlaneCount() const { return plane_count_; }
+
+int PolicyTable::GetSize() const { return plane_count_ * width_ * height_; }
+
+}  // namespace aithena
@@ -0,0 +1,51 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#ifndef AITHENA_ALPHAZERO_POLICY_TABLE_H_
+#define AITHENA_ALPHAZERO_POLICY_TABLE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "board/board_plane.h"
+#include "chess/piece.h"
+#include "chess/state.h"
+
+namespace aithena {
+
+// Maps moves to the index of their action value in the flattened output of the neural net (planes x width x height),
+// which is rotated towards the player making the move. The table of a board geometry is built once and turns encoding
+// and decoding of policies into a single load per move.
+class PolicyTable {
+ public:
+  // Returns the table for the given board geometry, building it on first use. Tables are never freed. Thread-safe.
+  static const PolicyTable &Get(int width, int height);
+
+  // Returns the index of the move of the given player. promotion is the figure a pawn is promoted to (kInvalid for
+  // moves without promotion).
+  int GetIndex(chess::Player player, Coord from, Coord to, chess::Figure promotion = chess::Figure::kInvalid) const;
+  // Returns the index of the move that resulted in the given state.
+  int GetIndex(chess::State::StatePtr) const;
+
+  int GetWidth() const;
+  int GetHeight() const;
+  // Returns the number of output planes (see GetNNOutputSize).
+  int GetPlaneCount() const;
+  // Returns the number of values of the flattened output.
+  int GetSize() const;
+
+ private:
+  PolicyTable(int width, int height);
+
+  int width_;
+  int height_;
+  int plane_count_;
+
+  // Indices by player making the move, promotion (none, knight, bishop, rook), source and target square
+  std::vector<std::int32_t> indices_;
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_ALPHAZERO_POLICY_TABLE_H_
@@ -0,0 +1,314 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/quantization.h"
+
+#include <ATen/core/dispatch/Dispatcher.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "benchmark/search_report.h"
+
+namespace aithena {
+
+namespace {
+
+// Affine quantization of activations (value = scale * (quantized value - zero_point))
+struct Quantization {
+  double scale{1};
+  int64_t zero_point{0};
+};
+
+// Returns the quint8 quantization covering the range of the given calibration activations and zero.
+Quantization GetQuantization(torch::Tensor activations) {
+  double min = std::min(activations.min().item<double>(), 0.0);
+  double max = std::max(activations.max().item<double>(), 0.0);
+
+  Quantization quantization;
+  quantization.scale = std::max((max - min) / 255.0, 1e-8);
+  quantization.zero_point = std::min<int64_t>(std::max<int64_t>(std::llround(-min / quantization.scale), 0), 255);
+
+  return quantization;
+}
+
+// Quantizes weights (output channels first) to qint8 with a symmetric scale per output channel.
+torch::Tensor QuantizeWeight(torch::Tensor weight) {
+  int64_t channels = weight.size(0);
+
+  torch::Tensor max = weight.abs().reshape({channels, -1}).amax(1);
+  torch::Tensor scales = (max / 127.0).clamp_min(1e-8).to(torch::kFloat64);
+  torch::Tensor zero_points = torch::zeros({channels}, torch::kInt64);
+
+  return torch::quantize_per_channel(weight.contiguous(), scales, zero_points, 0, torch::kQInt8);
+}
+
+// The quantized operators of libtorch (backed by fbgemm or oneDNN) are only registered with the dispatcher.
+c10::OperatorHandle FindOperator(const char *name, const char *overload) {
+  return c10::Dispatcher::singleton().findSchemaOrThrow(name, overload);
+}
+
+c10::IValue CallOperator(const c10::OperatorHandle &op, c10::Stack stack) {
+  op.callBoxed(&stack);
+
+  return stack[0];
+}
+
+std::vector<int64_t> ToVector(const torch::ExpandingArray<2> &array) {
+  return std::vector<int64_t>(array->begin(), array->end());
+}
+
+struct QuantizeImpl : torch::nn::Module {
+  explicit QuantizeImpl(Quantization quantization) : quantization_{quantization} {}
+
+  torch::Tensor forward(torch::Tensor x) {
+    return torch::quantize_per_tensor(x, quantization_.scale, quantization_.zero_point, torch::kQUInt8);
+  }
+
+  Quantization quantization_;
+};
+
+struct DequantizeImpl : torch::nn::Module {
+  torch::Tensor forward(torch::Tensor x) { return x.dequantize(); }
+};
+
+// Convolution of quantized activations with int8 weights, optionally followed by a ReLU
+struct QuantizedConv2dImpl : torch::nn::Module {
+  QuantizedConv2dImpl(torch::nn::Conv2d conv, bool relu, Quantization output)
+      : operator_{FindOperator(relu ? "quantized::conv2d_relu" : "quantized::conv2d", "new")}, output_{output} {
+    const torch::nn::Conv2dOptions &options = conv->options;
+
+    packed_weight_ = CallOperator(
+        FindOperator("quantized::conv2d_prepack", ""),
+        {QuantizeWeight(conv->weight), conv->bias.defined() ? c10::IValue(conv->bias) : c10::IValue(),
+         ToVector(options.stride()), ToVector(std::get<torch::ExpandingArray<2>>(options.padding())),
+         ToVector(options.dilation()), options.groups()});
+  }
+
+  torch::Tensor forward(torch::Tensor x) {
+    return CallOperator(operator_, {x, packed_weight_, output_.scale, output_.zero_point}).toTensor();
+  }
+
+  c10::OperatorHandle operator_;
+  c10::IValue packed_weight_;
+  Quantization output_;
+};
+
+// Linear layer on quantized activations with int8 weights, optionally followed by a ReLU
+struct QuantizedLinearImpl : torch::nn::Module {
+  QuantizedLinearImpl(torch::nn::Linear linear, bool relu, Quantization output)
+      : operator_{FindOperator(relu ? "quantized::linear_relu" : "quantized::linear", "")}, output_{output} {
+    c10::IValue bias = linear->bias.defined() ? c10::IValue(linear->bias) : c10::IValue();
+
+    packed_weight_ =
+        CallOperator(FindOperator("quantized::linear_prepack", ""), {QuantizeWeight(linear->weight), bias});
+  }
+
+  torch::Tensor forward(torch::Tensor x) {
+    return CallOperator(operator_, {x, packed_weight_, output_.scale, output_.zero_point}).toTensor();
+  }
+
+  c10::OperatorHandle operator_;
+  c10::IValue packed_weight_;
+  Quantization output_;
+};
+
+// Residual block (without batch normalization, see ResidualBlockImpl::Fuse) on quantized activations. hidden, residual
+// and output are the quantizations of the first convolution, the second convolution and the block.
+struct QuantizedResidualBlockImpl : torch::nn::Module {
+  QuantizedResidualBlockImpl(ResidualBlockImpl &block, Quantization hidden, Quantization residual, Quantization output)
+      : conv1_{std::make_shared<QuantizedConv2dImpl>(block.conv1_, true, hidden)},
+        conv2_{std::make_shared<QuantizedConv2dImpl>(block.conv2_, false, residual)},
+        add_relu_{FindOperator("quantized::add_relu", "")},
+        output_{output} {}
+
+  torch::Tensor forward(torch::Tensor x) {
+    torch::Tensor residual = conv2_->forward(conv1_->forward(x));
+
+    return CallOperator(add_relu_, {residual, x, output_.scale, output_.zero_point}).toTensor();
+  }
+
+  std::shared_ptr<QuantizedConv2dImpl> conv1_;
+  std::shared_ptr<QuantizedConv2dImpl> conv2_;
+  c10::OperatorHandle add_relu_;
+  Quantization output_;
+};
+
+// Returns the quantized counterpart of float layers without batch normalization. activations holds the calibration
+// inputs of the layers and is replaced by their outputs. quantized tells whether the inputs are quantized and is
+// updated for the outputs. A convolution on float inputs remains float and quantizes its output.
+torch::nn::Sequential QuantizeLayers(torch::nn::Sequential layers, torch::Tensor *activations, bool *quantized,
+                                     bool dequantize_output) {
+  torch::nn::Sequential quantized_layers;
+
+  auto quantize_input = [&]() {
+    if (*quantized) return;
+
+    quantized_layers->push_back(std::make_shared<QuantizeImpl>(GetQuantization(*activations)));
+    *quantized = true;
+  };
+
+  for (std::size_t i = 0; i < layers->size(); ++i) {
+    std::shared_ptr<torch::nn::Module> module = layers->ptr(i);
+    std::shared_ptr<torch::nn::Module> next = i + 1 < layers->size() ? layers->ptr(i + 1) : nullptr;
+
+    // ReLUs following a convolution or linear layer are fused into it.
+    auto relu = std::dynamic_pointer_cast<torch::nn::ReLUImpl>(next);
+
+    if (auto conv = std::dynamic_pointer_cast<torch::nn::Conv2dImpl>(module)) {
+      torch::Tensor output = conv->forward(*activations);
+      if (relu) output = torch::relu(output);
+
+      if (*quantized) {
+        quantized_layers->push_back(
+            std::make_shared<QuantizedConv2dImpl>(torch::nn::Conv2d(conv), relu != nullptr, GetQuantization(output)));
+      } else {
+        quantized_layers->push_back(torch::nn::Conv2d(conv));
+        if (relu) quantized_layers->push_back(torch::nn::ReLU(relu));
+        quantized_layers->push_back(std::make_shared<QuantizeImpl>(GetQuantization(output)));
+
+        *quantized = true;
+      }
+
+      if (relu) ++i;
+      *activations = output;
+    } else if (auto linear = std::dynamic_pointer_cast<torch::nn::LinearImpl>(module)) {
+      quantize_input();
+
+      torch::Tensor output = linear->forward(*activations);
+      if (relu) output = torch::relu(output);
+
+      quantized_layers->push_back(
+          std::make_shared<QuantizedLinearImpl>(torch::nn::Linear(linear), relu != nullptr, GetQuantization(output)));
+
+      if (relu) ++i;
+      *activations = output;
+    } else if (auto block = std::dynamic_pointer_cast<ResidualBlockImpl>(module)) {
+      if (!block->bn1_.is_empty()) throw std::invalid_argument("Residual blocks must be fused before quantization");
+
+      quantize_input();
+
+      torch::Tensor hidden = torch::relu(block->conv1_(*activations));
+      torch::Tensor residual = block->conv2_(hidden);
+      torch::Tensor output = torch::relu(residual + *activations);
+
+      quantized_layers->push_back(std::make_shared<QuantizedResidualBlockImpl>(
+          *block, GetQuantization(hidden), GetQuantization(residual), GetQuantization(output)));
+
+      *activations = output;
+    } else if (auto flatten = std::dynamic_pointer_cast<torch::nn::FlattenImpl>(module)) {
+      quantized_layers->push_back(torch::nn::Flatten(flatten));
+      *activations = flatten->forward(*activations);
+    } else if (auto single_relu = std::dynamic_pointer_cast<torch::nn::ReLUImpl>(module)) {
+      quantized_layers->push_back(torch::nn::ReLU(single_relu));
+      *activations = torch::relu(*activations);
+    } else if (auto tanh = std::dynamic_pointer_cast<torch::nn::TanhImpl>(module)) {
+      // The output layer is evaluated in float.
+      if (*quantized) quantized_layers->push_back(std::make_shared<DequantizeImpl>());
+      *quantized = false;
+
+      quantized_layers->push_back(torch::nn::Tanh(tanh));
+      *activations = torch::tanh(*activations);
+    } else {
+      throw std::invalid_argument("Cannot quantize layer " + module->name());
+    }
+  }
+
+  if (dequantize_output && *quantized) {
+    quantized_layers->push_back(std::make_shared<DequantizeImpl>());
+    *quantized = false;
+  }
+
+  return quantized_layers;
+}
+
+}  // namespace
+
+double QuantizationReport::GetSpeedup() const {
+  return float_throughput > 0 ? quantized_throughput / float_throughput : 0.0;
+}
+
+void QuantizationReport::Print(std::ostream &out) const {
+  out << "Quantization: " << 100.0 * policy_agreement << "% policy agreement, " << value_error
+      << " mean value error on " << samples << " inputs" << std::endl;
+  out << "Inference throughput: " << float_throughput << " float, " << quantized_throughput
+      << " int8 inputs per second (" << GetSpeedup() << "x)" << std::endl;
+}
+
+std::ostream &operator<<(std::ostream &out, const QuantizationReport &report) {
+  report.Print(out);
+
+  return out;
+}
+
+bool SupportsQuantization() { return at::globalContext().qEngine() != at::QEngine::NoQEngine; }
+
+std::shared_ptr<AlphaZeroNetImpl> QuantizeNetwork(AlphaZeroNet net, torch::Tensor calibration_inputs) {
+  torch::NoGradGuard no_grad;
+
+  std::shared_ptr<AlphaZeroNetImpl> fused = net->PrepareForInference();
+  fused->to(torch::kCPU);
+
+  torch::Tensor activations = calibration_inputs.to(torch::kCPU, torch::kFloat32);
+  bool quantized = false;
+
+  torch::nn::Sequential body = QuantizeLayers(fused->body_, &activations, &quantized, false);
+
+  // Both heads are calibrated on the output of the body.
+  torch::Tensor features = activations;
+  bool features_quantized = quantized;
+
+  torch::nn::Sequential policy_head = QuantizeLayers(fused->policy_head_, &activations, &quantized, true);
+
+  activations = features;
+  quantized = features_quantized;
+
+  torch::nn::Sequential value_head = QuantizeLayers(fused->value_head_, &activations, &quantized, true);
+
+  auto quantized_net = std::make_shared<AlphaZeroNetImpl>(body, policy_head, value_head, fused->GetGeneration());
+  quantized_net->eval();
+
+  return quantized_net;
+}
+
+QuantizationReport CompareNetworks(AlphaZeroNet reference, AlphaZeroNet quantized, torch::Tensor inputs) {
+  torch::InferenceMode inference_mode;
+
+  QuantizationReport report;
+  report.samples = static_cast<int>(inputs.size(0));
+
+  if (report.samples == 0) return report;
+
+  // Warm up both networks so that one-time allocations are not timed.
+  reference->forward(inputs.narrow(0, 0, 1));
+  quantized->forward(inputs.narrow(0, 0, 1));
+
+  PhaseTimer timer;
+
+  std::tuple<torch::Tensor, torch::Tensor> expected = reference->forward(inputs);
+  long float_time = timer.Lap();
+
+  std::tuple<torch::Tensor, torch::Tensor> output = quantized->forward(inputs);
+  long quantized_time = timer.Lap();
+
+  torch::Tensor expected_moves = std::get<0>(expected).reshape({report.samples, -1}).argmax(1);
+  torch::Tensor moves = std::get<0>(output).reshape({report.samples, -1}).argmax(1);
+
+  report.policy_agreement = moves.eq(expected_moves).to(torch::kFloat64).mean().item<double>();
+  report.value_error = (std::get<1>(output) - std::get<1>(expected)).abs().to(torch::kFloat64).mean().item<double>();
+
+  double samples = static_cast<double>(report.samples);
+  report.float_throughput = samples * 1e9 / static_cast<double>(std::max(float_time, 1L));
+  report.quantized_throughput = samples * 1e9 / static_cast<double>(std::max(quantized_time, 1L));
+
+  return report;
+}
+
+}  // namespace aithena
@@ -0,0 +1,53 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#ifndef AITHENA_ALPHAZERO_QUANTIZATION_H_
+#define AITHENA_ALPHAZERO_QUANTIZATION_H_
+
+#include <torch/torch.h>
+
+#include <memory>
+#include <ostream>
+
+#include "alphazero/nn.h"
+
+namespace aithena {
+
+// Compares a quantized network with the float network it was made from on the same inputs.
+struct QuantizationReport {
+  // Number of compared inputs
+  int samples{0};
+  // Share of inputs for which both networks assign the highest action value to the same move
+  double policy_agreement{0};
+  // Mean absolute difference of the state values
+  double value_error{0};
+  // Inputs evaluated per second by the float and the quantized network
+  double float_throughput{0};
+  double quantized_throughput{0};
+
+  // Returns the throughput of the quantized network relative to the float network.
+  double GetSpeedup() const;
+
+  // Writes a human readable summary to the given stream.
+  void Print(std::ostream &) const;
+};
+
+std::ostream &operator<<(std::ostream &, const QuantizationReport &);
+
+// Returns whether libtorch provides a quantized engine (fbgemm, x86 or oneDNN) on this machine.
+bool SupportsQuantization();
+
+// Returns a copy of an inference network (see AlphaZeroNetImpl::PrepareForInference) with static int8 quantization of
+// the residual tower and both heads. Weights are quantized symmetrically per output channel, activations with fixed
+// scales chosen from their range on the calibration inputs (a batch of network inputs, e.g. from the replay memory).
+// The first convolution remains float as the move counters of the input would dominate the input scale. The copy runs
+// on the CPU only, its outputs are float32.
+std::shared_ptr<AlphaZeroNetImpl> QuantizeNetwork(AlphaZeroNet, torch::Tensor calibration_inputs);
+
+// Evaluates both networks on a batch of network inputs and compares their outputs and throughput.
+QuantizationReport CompareNetworks(AlphaZeroNet reference, AlphaZeroNet quantized, torch::Tensor inputs);
+
+}  // namespace aithena
+
+#endif  // AITHENA_ALPHAZERO_QUANTIZATION_H_
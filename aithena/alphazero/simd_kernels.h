@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#ifndef AITHENA_ALPHAZERO_SIMD_KERNELS_H_
+#define AITHENA_ALPHAZERO_SIMD_KERNELS_H_
+
+namespace aithena {
+
+// Convolution with a 3x3 kernel, padding 1 and a ReLU (see Conv3x3). residual is added before the ReLU if not nullptr.
+using ConvKernel = void (*)(const float *input, int input_channels, const float *weight, const float *bias,
+                            const float *residual, float *output);
+
+// Return the convolution kernel of a board geometry and output channel count for the instruction set, nullptr if the
+// kernel is not instantiated or the library was built without support for the instruction set.
+ConvKernel GetGenericConvKernel(int width, int height, int channels);
+ConvKernel GetAvx2ConvKernel(int width, int height, int channels);
+ConvKernel GetAvx512ConvKernel(int width, int height, int channels);
+
+// The kernels are instantiated once per instruction set, each in its own translation unit compiled for it. Ops
+// provides the vector type Vec of kLanes floats and its operations. It must have internal linkage so that the
+// instantiations of different instruction sets are never merged by the linker.
+//
+// Activations are stored channels-last with a zero border of one square, i.e. as (width + 2) x (height + 2) x
+// channels, the weights as 3 x 3 x input channels x output channels. kChannels must be a multiple of kLanes.
+template <class Ops, int kWidth, int kHeight, int kChannels>
+void Conv3x3(const float *input, int input_channels, const float *weight, const float *bias, const float *residual,
+             float *output) {
+  using Vec = typename Ops::Vec;
+
+  constexpr int kStride = kHeight + 2;
+  constexpr int kBlocks = kChannels / Ops::kLanes;
+  // Number of vectors accumulated at once, which are kept in registers
+  constexpr int kChunk = kBlocks < 8 ? kBlocks : 8;
+
+  static_assert(kChannels % Ops::kLanes == 0 && kBlocks % kChunk == 0, "Unsupported channel count");
+
+  for (int i = 0; i < kWidth; ++i) {
+    for (int j = 0; j < kHeight; ++j) {
+      int square = (i + 1) * kStride + j + 1;
+
+      for (int chunk = 0; chunk < kBlocks; chunk += kChunk) {
+        int offset = chunk * Ops::kLanes;
+
+        Vec sums[kChunk];
+        for (int b = 0; b < kChunk; ++b) sums[b] = Ops::Load(bias + offset + b * Ops::kLanes);
+
+        for (int k = 0; k < 9; ++k) {
+          const float *in = input + (square + (k / 3 - 1) * kStride + k % 3 - 1) * input_channels;
+          const float *w = weight + k * input_channels * kChannels + offset;
+
+          for (int c = 0; c < input_channels; ++c, w += kChannels) {
+            Vec x = Ops::Broadcast(in[c]);
+
+            for (int b = 0; b < kChunk; ++b) sums[b] = Ops::FMA(x, Ops::Load(w + b * Ops::kLanes), sums[b]);
+          }
+        }
+
+        float *out = output + square * kChannels + offset;
+        const float *res = residual != nullptr ? residual + square * kChannels + offset : nullptr;
+
+        for (int b = 0; b < kChunk; ++b) {
+          Vec sum = sums[b];
+          if (res != nullptr) sum = Ops::Add(sum, Ops::Load(res + b * Ops::kLanes));
+
+          Ops::Store(out + b * Ops::kLanes, Ops::Max(sum, Ops::Zero()));
+        }
+      }
+    }
+  }
+}
+
+template <class Ops, int kWidth, int kHeight>
+ConvKernel SelectConvKernel(int channels) {
+  switch (channels) {
+    case 16:
+      return &Conv3x3<Ops, kWidth, kHeight, 16>;
+    case 32:
+      return &Conv3x3<Ops, kWidth, kHeight, 32>;
+    case 64:
+      return &Conv3x3<Ops, kWidth, kHeight, 64>;
+    case 128:
+      return &Conv3x3<Ops, kWidth, kHeight, 128>;
+    case 256:
+      return &Conv3x3<Ops, kWidth, kHeight, 256>;
+    default:
+      return nullptr;
+  }
+}
+
+// Returns the instantiation for the geometry: 5x5, 6x6 or 8x8 boards with 16, 32, 64, 128 or 256 channels.
+template <class Ops>
+ConvKernel SelectConvKernel(int width, int height, int channels) {
+  if (width == 5 && height == 5) return SelectConvKernel<Ops, 5, 5>(channels);
+  if (width == 6 && height == 6) return SelectConvKernel<Ops, 6, 6>(channels);
+  if (width == 8 && height == 8) return SelectConvKernel<Ops, 8, 8>(channels);
+
+  return nullptr;
+}
+
+}  // namespace aithena
+
+#endif  // AITHENA_ALPHAZERO_SIMD_KERNELS_H_
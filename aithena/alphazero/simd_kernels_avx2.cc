@@ -0,0 +1,42 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/simd_kernels.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace aithena {
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+namespace {
+
+struct Avx2Ops {
+  using Vec = __m256;
+  static constexpr int kLanes = 8;
+
+  static Vec Load(const float *p) { return _mm256_loadu_ps(p); }
+  static void Store(float *p, Vec v) { _mm256_storeu_ps(p, v); }
+  static Vec Broadcast(float x) { return _mm256_set1_ps(x); }
+  static Vec Zero() { return _mm256_setzero_ps(); }
+  static Vec FMA(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+  static Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  static Vec Max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+};
+
+}  // namespace
+
+ConvKernel GetAvx2ConvKernel(int width, int height, int channels) {
+  return SelectConvKernel<Avx2Ops>(width, height, channels);
+}
+
+#else
+
+ConvKernel GetAvx2ConvKernel(int, int, int) { return nullptr; }
+
+#endif
+
+}  // namespace aithena
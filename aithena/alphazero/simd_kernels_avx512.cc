@@ -0,0 +1,42 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/simd_kernels.h"
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace aithena {
+
+#if defined(__AVX512F__)
+
+namespace {
+
+struct Avx512Ops {
+  using Vec = __m512;
+  static constexpr int kLanes = 16;
+
+  static Vec Load(const float *p) { return _mm512_loadu_ps(p); }
+  static void Store(float *p, Vec v) { _mm512_storeu_ps(p, v); }
+  static Vec Broadcast(float x) { return _mm512_set1_ps(x); }
+  static Vec Zero() { return _mm512_setzero_ps(); }
+  static Vec FMA(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+  static Vec Add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+  static Vec Max(Vec a, Vec b) { return _mm512_maskz_max_ps(static_cast<__mmask16>(0xffff), a, b); }
+};
+
+}  // namespace
+
+ConvKernel GetAvx512ConvKernel(int width, int height, int channels) {
+  return SelectConvKernel<Avx512Ops>(width, height, channels);
+}
+
+#else
+
+ConvKernel GetAvx512ConvKernel(int, int, int) { return nullptr; }
+
+#endif
+
+}  // namespace aithena
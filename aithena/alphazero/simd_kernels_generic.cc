@@ -0,0 +1,31 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/simd_kernels.h"
+
+namespace aithena {
+
+namespace {
+
+// Single floats, vectorized by the compiler where the target allows it
+struct GenericOps {
+  using Vec = float;
+  static constexpr int kLanes = 1;
+
+  static Vec Load(const float *p) { return *p; }
+  static void Store(float *p, Vec v) { *p = v; }
+  static Vec Broadcast(float x) { return x; }
+  static Vec Zero() { return 0.0f; }
+  static Vec FMA(Vec a, Vec b, Vec c) { return a * b + c; }
+  static Vec Add(Vec a, Vec b) { return a + b; }
+  static Vec Max(Vec a, Vec b) { return a > b ? a : b; }
+};
+
+}  // namespace
+
+ConvKernel GetGenericConvKernel(int width, int height, int channels) {
+  return SelectConvKernel<GenericOps>(width, height, channels);
+}
+
+}  // namespace aithena
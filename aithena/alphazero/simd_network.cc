@@ -0,0 +1,196 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#include "alphazero/simd_network.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace aithena {
+
+namespace {
+
+struct InstructionSet {
+  const char *name;
+  ConvKernel (*get_kernel)(int width, int height, int channels);
+};
+
+// Returns the instruction sets supported by the CPU, widest first.
+std::vector<InstructionSet> GetInstructionSets() {
+  std::vector<InstructionSet> instruction_sets;
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx512f")) instruction_sets.push_back({"avx512", &GetAvx512ConvKernel});
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    instruction_sets.push_back({"avx2", &GetAvx2ConvKernel});
+#endif
+
+  instruction_sets.push_back({"generic", &GetGenericConvKernel});
+
+  return instruction_sets;
+}
+
+float Dot(const float *a, const float *b, std::size_t size) {
+  float sum = 0;
+  for (std::size_t i = 0; i < size; ++i) sum += a[i] * b[i];
+
+  return sum;
+}
+
+}  // namespace
+
+std::unique_ptr<SimdNetwork> SimdNetwork::Create(const SimdNetworkWeights &weights) {
+  if (!IsSupported(weights.width, weights.height, weights.channels)) return nullptr;
+
+  std::unique_ptr<SimdNetwork> network(new SimdNetwork());
+
+  network->width_ = weights.width;
+  network->height_ = weights.height;
+  network->input_channels_ = weights.input_channels;
+  network->channels_ = weights.channels;
+  network->policy_planes_ = weights.policy_planes;
+
+  // Instruction sets built without support (e.g. by other compilers) provide no kernels.
+  for (auto &instruction_set : GetInstructionSets()) {
+    network->conv_ = instruction_set.get_kernel(weights.width, weights.height, weights.channels);
+    network->policy_conv_ = instruction_set.get_kernel(weights.width, weights.height, kChannelAlignment);
+    network->instruction_set_ = instruction_set.name;
+
+    if (network->conv_ != nullptr && network->policy_conv_ != nullptr) break;
+  }
+
+  int channels = weights.channels;
+
+  network->input_ = ConvertConv(weights.input, weights.input_channels, channels);
+  for (auto &layer : weights.residual) network->residual_.push_back(ConvertConv(layer, channels, channels));
+
+  network->policy_hidden_ = ConvertConv(weights.policy_hidden, channels, channels);
+
+  for (int first = 0; first < weights.policy_planes; first += kChannelAlignment) {
+    int count = std::min(kChannelAlignment, weights.policy_planes - first);
+    std::size_t weights_per_plane = static_cast<std::size_t>(channels * 9);
+
+    SimdNetworkWeights::Layer group;
+    group.weight.assign(weights.policy_output.weight.begin() + first * weights_per_plane,
+                        weights.policy_output.weight.begin() + (first + count) * weights_per_plane);
+    group.bias.assign(weights.policy_output.bias.begin() + first,
+                      weights.policy_output.bias.begin() + first + count);
+
+    network->policy_output_.push_back(ConvertConv(group, channels, count));
+  }
+
+  network->value_conv_ = weights.value_conv;
+  network->value_hidden_ = weights.value_hidden;
+  network->value_output_ = weights.value_output;
+
+  return network;
+}
+
+bool SimdNetwork::IsSupported(int width, int height, int channels) {
+  // All instruction sets instantiate the same geometries.
+  return GetGenericConvKernel(width, height, channels) != nullptr &&
+         GetGenericConvKernel(width, height, kChannelAlignment) != nullptr;
+}
+
+void SimdNetwork::Forward(const float *input, int batch, float *action_values, float *state_values) const {
+  int stride = height_ + 2;
+  int squares = (width_ + 2) * stride;
+  int plane_size = width_ * height_;
+
+  // Activations of the layers, the kernels only write the inner squares and the border remains zero.
+  std::vector<float> features(static_cast<std::size_t>(squares * input_channels_), 0);
+  std::vector<float> x(static_cast<std::size_t>(squares * channels_), 0);
+  std::vector<float> y(x.size(), 0);
+  std::vector<float> hidden(x.size(), 0);
+  std::vector<float> policy_planes(static_cast<std::size_t>(squares * kChannelAlignment), 0);
+  std::vector<float> value_plane(static_cast<std::size_t>(squares), 0);
+  std::vector<float> value_hidden(value_hidden_.bias.size(), 0);
+
+  for (int n = 0; n < batch; ++n) {
+    const float *in = input + static_cast<std::ptrdiff_t>(n) * input_channels_ * plane_size;
+
+    for (int c = 0; c < input_channels_; ++c)
+      for (int i = 0; i < width_; ++i)
+        for (int j = 0; j < height_; ++j)
+          features[((i + 1) * stride + j + 1) * input_channels_ + c] = in[(c * width_ + i) * height_ + j];
+
+    // Body
+    conv_(features.data(), input_channels_, input_.weight.data(), input_.bias.data(), nullptr, x.data());
+
+    for (std::size_t i = 0; i + 1 < residual_.size(); i += 2) {
+      conv_(x.data(), channels_, residual_[i].weight.data(), residual_[i].bias.data(), nullptr, hidden.data());
+      conv_(hidden.data(), channels_, residual_[i + 1].weight.data(), residual_[i + 1].bias.data(), x.data(),
+            y.data());
+
+      std::swap(x, y);
+    }
+
+    // Policy head
+    conv_(x.data(), channels_, policy_hidden_.weight.data(), policy_hidden_.bias.data(), nullptr, hidden.data());
+
+    float *policy = action_values + static_cast<std::ptrdiff_t>(n) * policy_planes_ * plane_size;
+
+    for (std::size_t group = 0; group < policy_output_.size(); ++group) {
+      const SimdNetworkWeights::Layer &layer = policy_output_[group];
+      int first = static_cast<int>(group) * kChannelAlignment;
+      int count = std::min(kChannelAlignment, policy_planes_ - first);
+
+      policy_conv_(hidden.data(), channels_, layer.weight.data(), layer.bias.data(), nullptr, policy_planes.data());
+
+      for (int p = 0; p < count; ++p)
+        for (int i = 0; i < width_; ++i)
+          for (int j = 0; j < height_; ++j)
+            policy[((first + p) * width_ + i) * height_ + j] =
+                policy_planes[((i + 1) * stride + j + 1) * kChannelAlignment + p];
+    }
+
+    // Value head, the 1x1 convolution covers the border as well (padding 1).
+    for (int s = 0; s < squares; ++s) {
+      float sum = value_conv_.bias[0] + Dot(value_conv_.weight.data(), x.data() + s * channels_, channels_);
+      value_plane[s] = std::max(sum, 0.0f);
+    }
+
+    for (std::size_t k = 0; k < value_hidden.size(); ++k) {
+      float sum = value_hidden_.bias[k] + Dot(value_hidden_.weight.data() + k * squares, value_plane.data(), squares);
+      value_hidden[k] = std::max(sum, 0.0f);
+    }
+
+    state_values[n] = std::tanh(value_output_.bias[0] +
+                                Dot(value_output_.weight.data(), value_hidden.data(), value_hidden.size()));
+  }
+}
+
+const char *SimdNetwork::GetInstructionSet() const { return instruction_set_; }
+
+int SimdNetwork::GetWidth() const { return width_; }
+
+int SimdNetwork::GetHeight() const { return height_; }
+
+int SimdNetwork::GetPolicyPlanes() const { return policy_planes_; }
+
+SimdNetworkWeights::Layer SimdNetwork::ConvertConv(const SimdNetworkWeights::Layer &layer, int input_channels,
+                                                   int output_channels) {
+  int padded_channels = (output_channels + kChannelAlignment - 1) / kChannelAlignment * kChannelAlignment;
+
+  SimdNetworkWeights::Layer converted;
+  converted.weight.assign(static_cast<std::size_t>(9 * input_channels * padded_channels), 0);
+  converted.bias.assign(static_cast<std::size_t>(padded_channels), 0);
+
+  for (int out = 0; out < output_channels; ++out) {
+    for (int in = 0; in < input_channels; ++in)
+      for (int k = 0; k < 9; ++k)
+        converted.weight[(k * input_channels + in) * padded_channels + out] =
+            layer.weight[(out * input_channels + in) * 9 + k];
+
+    converted.bias[out] = layer.bias[out];
+  }
+
+  return converted;
+}
+
+}  // namespace aithena
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2020 All Rights Reserved
+ */
+
+#ifndef AITHENA_ALPHAZERO_SIMD_NETWORK_H_
+#define AITHENA_ALPHAZERO_SIMD_NETWORK_H_
+
+#include <memory>
+#include <vector>
+
+#include "alphazero/simd_kernels.h"
+
+namespace aithena {
+
+// Weights of an AlphaZeroNetImpl with the batch normalizations folded into the convolutions (see
+// AlphaZeroNetImpl::PrepareForInference) in the layouts of libtorch, i.e. output x input (x kernel x kernel).
+struct SimdNetworkWeights {
+  struct Layer {
+    std::vector<float> weight;
+    std::vector<float> bias;
+  };
+
+  int width{0};
+  int height{0};
+  int input_channels{0};
+  int channels{0};
+  int policy_planes{0};
+
+  // Convolutions of the body, two per residual block
+  Layer input;
+  std::vector<Layer> residual;
+
+  Layer policy_hidden;
+  Layer policy_output;
+
+  // 1x1 convolution (padding 1) and both linear layers of the value head
+  Layer value_conv;
+  Layer value_hidden;
+  Layer value_output;
+};
+
+// Evaluates AlphaZeroNetImpl networks on the CPU without libtorch, which saves the dispatch overhead of small networks
+// on small boards. The convolutions are specialized at compile time for the board geometry and channel count (see
+// SelectConvKernel) and built for AVX-512, AVX2 and generic CPUs. The best kernels for the CPU are selected at runtime.
+class SimdNetwork {
+ public:
+  // Returns nullptr if no kernels exist for the geometry of the weights.
+  static std::unique_ptr<SimdNetwork> Create(const SimdNetworkWeights &);
+  static bool IsSupported(int width, int height, int channels);
+
+  // Evaluates a batch of network inputs (batch x input channels x width x height, see GetNNInput). Writes the action
+  // values (batch x policy planes x width x height) and state values (batch). Thread-safe.
+  void Forward(const float *input, int batch, float *action_values, float *state_values) const;
+
+  // Returns the instruction set of the selected kernels (avx512, avx2 or generic).
+  const char *GetInstructionSet() const;
+
+  int GetWidth() const;
+  int GetHeight() const;
+  int GetPolicyPlanes() const;
+
+ private:
+  SimdNetwork() = default;
+
+  // Converts a convolution from libtorch's layout to the layout of the kernels (see Conv3x3), padding the output
+  // channels with zeros to a multiple of kChannelAlignment.
+  static SimdNetworkWeights::Layer ConvertConv(const SimdNetworkWeights::Layer &, int input_channels,
+                                               int output_channels);
+
+  // Output channels of the kernels are padded to a multiple of the widest vector (AVX-512).
+  static constexpr int kChannelAlignment = 16;
+
+  int width_;
+  int height_;
+  int input_channels_;
+  int channels_;
+  int policy_planes_;
+  const char *instruction_set_;
+
+  ConvKernel conv_;
+  // Kernel of the final policy convolution, which is evaluated in groups of kChannelAlignment planes
+  ConvKernel policy_conv_;
+
+  SimdNetworkWeights::Layer input_;
+  std::vector<SimdNetworkWeights::Layer> residual_;
+  SimdNetworkWeights::Layer policy_hidden_;
+  // One layer per group of policy planes
+  std::vector<SimdNetworkWeights::Layer> policy_output_;
+  SimdNetworkWeights::Layer value_conv_;
+  SimdNetworkWeights::Layer value_hidden_;
+  SimdNetworkWeights::Layer value_output_;
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_ALPHAZERO_SIMD_NETWORK_H_
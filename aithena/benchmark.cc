@@ -2,11 +2,14 @@
 
 #include <getopt.h>
 
+#include <algorithm>
 #include <iostream>
 
 #include "alphazero/alphazero.h"
+#include "benchmark/search_report.h"
 #include "chess/game.h"
 #include "chess/util.h"
+#include "mcts/mcts.h"
 
 using namespace aithena;
 
@@ -16,9 +19,13 @@ std::string GetBenchmarkUsageText() {
          "## Benchmark Options ##\n"
          "  --alphazero                     Run alphazero test\n"
          "  --divide <depth>                Run divide test (for locating bugs)\n"
+         "  --mcts                          Run MCTS test\n"
          "  --perft <depth>                 Run perft test\n"
          "## AlphaZero Options ##\n"
+         "  --eval-cache <number>           Entries of the evaluation cache, 0 disables it (default: 0)\n"
          "  --no-cuda                       Disables using cuda\n"
+         "## Search Options ##\n"
+         "  --memory-limit <MB>             Maximum MCTS tree size, the tree is pruned beyond (default: no limit)\n"
          "  --simulations <number>          Number of simulations (default: 800)\n"
          "## Chess Options ##\n"
          "  --fen -f <string>               Initial board (default: 8-by-8 Chess)\n"
@@ -29,19 +36,25 @@ std::string GetBenchmarkUsageText() {
 enum GetOptOption : int {
   kOptAlphazero = 1000,
   kOptDivide,
+  kOptMCTS,
   kOptPerft,
+  kOptEvalCache,
   kOptNoCuda,
   kOptSimulations,
   kOptFEN,
   kOptMaxMoves,
-  kOptMaxNoProgress
+  kOptMaxNoProgress,
+  kOptMemoryLimit
 };
 
 int RunBenchmark(int argc, char** argv) {
   static struct option long_options[] = {{"help", no_argument, nullptr, 'h'},
                                          {"alphazero", no_argument, nullptr, kOptAlphazero},
                                          {"divide", required_argument, nullptr, kOptDivide},
+                                         {"mcts", no_argument, nullptr, kOptMCTS},
+                                         {"memory-limit", required_argument, nullptr, kOptMemoryLimit},
                                          {"perft", required_argument, nullptr, kOptPerft},
+                                         {"eval-cache", required_argument, nullptr, kOptEvalCache},
                                          {"no-cuda", no_argument, nullptr, kOptNoCuda},
                                          {"simulations", required_argument, nullptr, kOptSimulations},
                                          {"fen", required_argument, nullptr, kOptFEN},
@@ -55,7 +68,10 @@ int RunBenchmark(int argc, char** argv) {
   int divide{-1};
   int az_rounds{1};  // TODO: make configurable
   bool az_no_cuda{false};
+  int az_eval_cache{0};
   int az_simulations{800};
+  bool mcts{false};
+  long memory_limit{0};
   int perft{-1};
   int max_no_progress{50};
   int max_moves{1000};
@@ -77,9 +93,18 @@ int RunBenchmark(int argc, char** argv) {
       case kOptDivide:
         divide = atoi(optarg);
         break;
+      case kOptMCTS:
+        mcts = true;
+        break;
+      case kOptMemoryLimit:
+        memory_limit = atol(optarg);
+        break;
       case kOptPerft:
         perft = atoi(optarg);
         break;
+      case kOptEvalCache:
+        az_eval_cache = atoi(optarg);
+        break;
       case kOptNoCuda:
         az_no_cuda = true;
         break;
@@ -116,7 +141,9 @@ int RunBenchmark(int argc, char** argv) {
 
   if (divide >= 0) RunDivide(game, start, divide);
 
-  if (alphazero) RunAlphazeroBenchmark(game, start, az_simulations, az_rounds, az_no_cuda);
+  if (alphazero) RunAlphazeroBenchmark(game, start, az_simulations, az_rounds, az_no_cuda, az_eval_cache);
+
+  if (mcts) RunMCTSBenchmark(game, start, az_simulations, static_cast<std::size_t>(memory_limit) * 1024 * 1024);
 
   bm_bm.End();
 
@@ -126,7 +153,7 @@ int RunBenchmark(int argc, char** argv) {
 }
 
 void RunAlphazeroBenchmark(chess::Game::GamePtr game, chess::State::StatePtr state, int simulations,
-                           int evaluation_games, bool no_cuda) {
+                           int evaluation_games, bool no_cuda, int eval_cache_size) {
   Benchmark bm_alphazero;
 
   bm_alphazero.Start();
@@ -136,15 +163,19 @@ void RunAlphazeroBenchmark(chess::Game::GamePtr game, chess::State::StatePtr sta
   az.SetSimulations(simulations);
 
   if (no_cuda) az.SetUseCUDA(false);
+  if (eval_cache_size > 0) az.SetEvalCache(std::make_shared<EvalCache>(static_cast<std::size_t>(eval_cache_size)));
 
   chess::State::StatePtr current_state = state;
 
   int action_count = 0;
+  SearchReport report;
 
   for (int i = 0; i < evaluation_games; ++i) {
     while (!game->IsTerminalState(current_state)) {
       current_state = az.DrawAction(current_state);
       ++action_count;
+
+      report.Merge(az.GetLastReport());
     }
   }
 
@@ -159,6 +190,56 @@ void RunAlphazeroBenchmark(chess::Game::GamePtr game, chess::State::StatePtr sta
 
   for (auto bm : az.benchmark_.GetAvg(Benchmark::UNIT_MSEC))
     std::cout << std::get<0>(bm) << ": " << std::get<1>(bm) << " msec" << std::endl;
+
+  std::cout << "## Search Report ##" << std::endl << report;
+}
+
+void RunMCTSBenchmark(chess::Game::GamePtr game, chess::State::StatePtr state, int simulations,
+                      std::size_t memory_limit) {
+  Benchmark bm_mcts;
+
+  bm_mcts.Start();
+
+  MCTS mcts{game};
+
+  mcts.SetBudget({simulations, 0, 0, memory_limit, false});
+  mcts.StartSession();
+
+  chess::State::StatePtr current_state = state;
+
+  int action_count = 0;
+  long simulation_count = 0;
+  long pruned_count = 0;
+  std::size_t total_memory = 0;
+  std::size_t peak_memory = 0;
+  SearchReport report;
+
+  while (!game->IsTerminalState(current_state)) {
+    current_state = mcts.DrawAction(current_state);
+    ++action_count;
+
+    report.Merge(mcts.GetLastReport());
+
+    simulation_count += mcts.GetLastSimulations();
+    pruned_count += mcts.GetPrunedNodeCount();
+    total_memory += mcts.GetTreeMemoryUsage();
+    peak_memory = std::max(peak_memory, mcts.GetTreeMemoryUsage());
+  }
+
+  bm_mcts.End();
+
+  double usec = static_cast<double>(bm_mcts.GetLast(Benchmark::UNIT_USEC));
+  double aps = 1000000.0 * static_cast<double>(action_count) / usec;
+  double sps = 1000000.0 * static_cast<double>(simulation_count) / usec;
+
+  std::cout << "## MCTS ##" << std::endl;
+  std::cout << "Drew " << action_count << " actions in " << bm_mcts.GetLast(Benchmark::UNIT_SEC) << " seconds (" << aps
+            << " actions per second, " << sps << " simulations per second)" << std::endl;
+  std::cout << "Tree memory: " << peak_memory / 1024 << " KB peak, "
+            << (action_count > 0 ? total_memory / action_count / 1024 : 0) << " KB average" << std::endl;
+  std::cout << "Pruned nodes: " << pruned_count << std::endl;
+
+  std::cout << "## Search Report ##" << std::endl << report;
 }
 
 void RunPerftBenchmark(chess::Game::GamePtr game, chess::State::StatePtr state, int perft_depth) {
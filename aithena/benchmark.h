@@ -1,6 +1,8 @@
 #ifndef AITHENA_BENCHMARK_H_
 #define AITHENA_BENCHMARK_H_
 
+#include <cstddef>
+
 #include "chess/game.h"
 
 using namespace aithena;
@@ -8,7 +10,9 @@ using namespace aithena;
 int RunBenchmark(int argc, char** argv);
 
 void RunAlphazeroBenchmark(chess::Game::GamePtr, chess::State::StatePtr, int, int evaluation_games = 1,
-                           bool no_cuda = false);
+                           bool no_cuda = false, int eval_cache_size = 0);
+
+void RunMCTSBenchmark(chess::Game::GamePtr, chess::State::StatePtr, int simulations, std::size_t memory_limit = 0);
 
 void RunPerftBenchmark(chess::Game::GamePtr, chess::State::StatePtr, int);
 
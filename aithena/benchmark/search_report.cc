@@ -0,0 +1,102 @@
+#include "benchmark/search_report.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace aithena {
+
+void SearchReport::AddDepth(int depth) {
+  max_depth = std::max(max_depth, depth);
+  total_depth += depth;
+}
+
+void SearchReport::Merge(const SearchReport &other) {
+  simulations += other.simulations;
+  nodes_allocated += other.nodes_allocated;
+  tree_nodes = std::max(tree_nodes, other.tree_nodes);
+  tree_memory = std::max(tree_memory, other.tree_memory);
+  max_depth = std::max(max_depth, other.max_depth);
+  total_depth += other.total_depth;
+  cache_lookups += other.cache_lookups;
+  cache_hits += other.cache_hits;
+  time += other.time;
+  selection_time += other.selection_time;
+  expansion_time += other.expansion_time;
+  evaluation_time += other.evaluation_time;
+  backup_time += other.backup_time;
+}
+
+double SearchReport::GetSimulationsPerSecond() const {
+  if (time <= 0) return 0;
+
+  return 1e9 * static_cast<double>(simulations) / static_cast<double>(time);
+}
+
+double SearchReport::GetAverageDepth() const {
+  if (simulations <= 0) return 0;
+
+  return static_cast<double>(total_depth) / static_cast<double>(simulations);
+}
+
+double SearchReport::GetCacheHitRate() const {
+  if (cache_lookups <= 0) return 0;
+
+  return static_cast<double>(cache_hits) / static_cast<double>(cache_lookups);
+}
+
+double SearchReport::GetEffectiveBranchingFactor() const {
+  if (max_depth <= 0 || tree_nodes <= 1) return 0;
+
+  double nodes = static_cast<double>(tree_nodes);
+
+  // Number of nodes of a uniform tree with the given branching factor
+  auto tree_size = [this](double branching) {
+    double size = 1, level = 1;
+    for (int depth = 0; depth < max_depth; ++depth) {
+      level *= branching;
+      size += level;
+    }
+
+    return size;
+  };
+
+  // The tree size grows monotonically with the branching factor, which lies in (0, nodes - 1].
+  double low = 0, high = nodes - 1;
+  for (int i = 0; i < 64 && high - low > 1e-6; ++i) {
+    double mid = (low + high) / 2;
+
+    if (tree_size(mid) < nodes)
+      low = mid;
+    else
+      high = mid;
+  }
+
+  return (low + high) / 2;
+}
+
+void SearchReport::Print(std::ostream &out) const {
+  long phase_time = selection_time + expansion_time + evaluation_time + backup_time;
+  auto share = [phase_time](long t) {
+    return phase_time > 0 ? 100.0 * static_cast<double>(t) / static_cast<double>(phase_time) : 0.0;
+  };
+
+  out << "Simulations: " << simulations << " (" << GetSimulationsPerSecond() << " per second)" << std::endl;
+  out << "Nodes: " << nodes_allocated << " allocated, " << tree_nodes << " in tree (" << tree_memory / 1024 << " KB)"
+      << std::endl;
+  out << "Depth: " << max_depth << " max, " << GetAverageDepth() << " average" << std::endl;
+  out << "Effective branching factor: " << GetEffectiveBranchingFactor() << std::endl;
+  if (cache_lookups > 0)
+    out << "Evaluation cache: " << cache_hits << " hits in " << cache_lookups << " lookups ("
+        << 100.0 * GetCacheHitRate() << "%)" << std::endl;
+  out << "Time: " << time / 1000 << " usec (selection " << share(selection_time) << "%, expansion "
+      << share(expansion_time) << "%, evaluation " << share(evaluation_time) << "%, backup " << share(backup_time)
+      << "%)" << std::endl;
+}
+
+std::ostream &operator<<(std::ostream &out, const SearchReport &report) {
+  report.Print(out);
+
+  return out;
+}
+
+}  // namespace aithena
@@ -0,0 +1,80 @@
+#ifndef AITHENA_BENCHMARK_SEARCH_REPORT_H
+#define AITHENA_BENCHMARK_SEARCH_REPORT_H
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+namespace aithena {
+
+// Telemetry of a single tree search (e.g. one call to MCTS::DrawAction). All times are given in nanoseconds.
+struct SearchReport {
+  // Number of simulations run
+  int simulations{0};
+  // Number of nodes created during the search
+  long nodes_allocated{0};
+  // Number of nodes and estimated memory usage in bytes of the search tree at the end of the search
+  long tree_nodes{0};
+  std::size_t tree_memory{0};
+
+  // Depth (relative to the root of the search) of the deepest node evaluated by any simulation
+  int max_depth{0};
+  // Summed depth of the nodes evaluated by all simulations
+  long total_depth{0};
+
+  // Lookups and hits of the evaluation cache (AlphaZero only)
+  long cache_lookups{0};
+  long cache_hits{0};
+
+  // Wall-clock time of the whole search
+  long time{0};
+  // Time spent in the individual phases of all simulations
+  long selection_time{0};
+  long expansion_time{0};
+  long evaluation_time{0};
+  long backup_time{0};
+
+  // Resets all counters.
+  void Clear() { *this = SearchReport(); }
+
+  // Records the depth of the node evaluated by a simulation.
+  void AddDepth(int depth);
+  // Accumulates the report of another search. Counters and times are summed, the tree size and maximum depth keep the
+  // larger value.
+  void Merge(const SearchReport &);
+
+  double GetSimulationsPerSecond() const;
+  double GetAverageDepth() const;
+  double GetCacheHitRate() const;
+  // Returns the branching factor b* a uniform tree of depth max_depth would need to contain tree_nodes nodes, i.e. the
+  // solution of tree_nodes = 1 + b* + b*^2 + ... + b*^max_depth.
+  double GetEffectiveBranchingFactor() const;
+
+  // Writes a human readable summary to the given stream.
+  void Print(std::ostream &) const;
+};
+
+std::ostream &operator<<(std::ostream &, const SearchReport &);
+
+// Measures consecutive phases of a search.
+class PhaseTimer {
+ public:
+  PhaseTimer() : last_{std::chrono::steady_clock::now()} {}
+
+  // Returns the nanoseconds passed since the last call to Lap or the construction of the timer.
+  long Lap() {
+    auto now = std::chrono::steady_clock::now();
+    long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+
+    last_ = now;
+
+    return elapsed;
+  }
+
+ private:
+  std::chrono::steady_clock::time_point last_;
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_BENCHMARK_SEARCH_REPORT_H
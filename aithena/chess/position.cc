@@ -0,0 +1,510 @@
+/*
+Copyright 2020 All rights reserved.
+*/
+
+#include "chess/position.h"
+
+#include <assert.h>
+
+#include <cstring>
+#include <memory>
+
+namespace aithena {
+namespace chess {
+
+namespace {
+
+const int kRookDirections[4][2] = {{0, 1}, {0, -1}, {-1, 0}, {1, 0}};
+const int kBishopDirections[4][2] = {{-1, 1}, {1, 1}, {-1, -1}, {1, -1}};
+const int kQueenDirections[8][2] = {{-1, 1}, {1, 1}, {-1, -1}, {1, -1}, {0, 1}, {0, -1}, {-1, 0}, {1, 0}};
+const int kKnightDirections[8][2] = {{-1, 2}, {1, 2}, {-1, -2}, {1, -2}, {-2, 1}, {2, 1}, {-2, -1}, {2, -1}};
+
+// MoveInfo special codes of the promotion figures in the order of Game::figures (queen, rook, knight, bishop).
+const int kPromotionCodes[4] = {3, 2, 0, 1};
+
+const int kFigureValues[static_cast<int>(Figure::kCount)] = {0, 9, 5, 3, 3, 1};
+
+Figure GetPromotionFigure(int code) {
+  switch (code & Move::kSpecialMask) {
+    case 0:
+      return Figure::kKnight;
+    case 1:
+      return Figure::kBishop;
+    case 2:
+      return Figure::kRook;
+    default:
+      return Figure::kQueen;
+  }
+}
+
+}  // namespace
+
+Position::Position(State &state) {
+  Board &board = state.GetBoard();
+
+  width_ = board.GetWidth();
+  height_ = board.GetHeight();
+
+  assert(width_ <= kMaxWidth && height_ <= kMaxHeight);
+
+  kings_ = {-1, -1};
+
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      Piece piece = board.GetField(x, y);
+
+      if (piece == kEmptyPiece) {
+        squares_[Index(x, y)] = kEmpty;
+        continue;
+      }
+
+      Figure figure = static_cast<Figure>(piece.figure);
+      Player player = static_cast<Player>(piece.player);
+
+      squares_[Index(x, y)] = MakeSquare(figure, player);
+
+      if (figure == Figure::kKing) kings_[player] = Index(x, y);
+    }
+  }
+
+  player_ = state.GetPlayer();
+  for (auto player : {Player::kWhite, Player::kBlack}) {
+    castle_queen_[player] = state.GetCastleQueen(player);
+    castle_king_[player] = state.GetCastleKing(player);
+  }
+  move_count_ = state.GetMoveCount();
+  no_progress_count_ = state.GetNoProgressCount();
+  double_push_pawn_ = state.GetDPushPawn();
+
+  if (state.move_info_ != nullptr) {
+    Coord from = state.move_info_->GetFrom();
+    Coord to = state.move_info_->GetTo();
+
+    last_move_ = {static_cast<std::uint16_t>(Index(from.x, from.y)), static_cast<std::uint16_t>(Index(to.x, to.y)),
+                  static_cast<std::uint8_t>(state.move_info_->GetFlagCode())};
+    has_last_move_ = true;
+  }
+}
+
+Position::Square Position::MakeSquare(Figure figure, Player player) {
+  return static_cast<Square>(1 + static_cast<int>(player) * static_cast<int>(Figure::kCount) +
+                             static_cast<int>(figure));
+}
+
+Figure Position::GetFigure(Square square) {
+  return static_cast<Figure>((square - 1) % static_cast<int>(Figure::kCount));
+}
+
+Player Position::GetOwner(Square square) {
+  return static_cast<Player>((square - 1) / static_cast<int>(Figure::kCount));
+}
+
+Piece Position::GetField(int x, int y) const {
+  Square square = squares_[Index(x, y)];
+
+  if (square == kEmpty) return kEmptyPiece;
+
+  return make_piece(GetFigure(square), GetOwner(square));
+}
+
+bool Position::IsAttacked(const Square *board, int index, Player attacker) const {
+  int x = index % width_;
+  int y = index / width_;
+
+  // Pawns attack diagonally towards the opponent
+  int pawn_y = y - (attacker == Player::kWhite ? 1 : -1);
+  Square pawn = MakeSquare(Figure::kPawn, attacker);
+  if (pawn_y >= 0 && pawn_y < height_) {
+    if (x > 0 && board[Index(x - 1, pawn_y)] == pawn) return true;
+    if (x < width_ - 1 && board[Index(x + 1, pawn_y)] == pawn) return true;
+  }
+
+  Square knight = MakeSquare(Figure::kKnight, attacker);
+  for (auto &direction : kKnightDirections) {
+    int nx = x + direction[0];
+    int ny = y + direction[1];
+
+    if (OnBoard(nx, ny) && board[Index(nx, ny)] == knight) return true;
+  }
+
+  Square king = MakeSquare(Figure::kKing, attacker);
+  Square queen = MakeSquare(Figure::kQueen, attacker);
+  Square rook = MakeSquare(Figure::kRook, attacker);
+  Square bishop = MakeSquare(Figure::kBishop, attacker);
+
+  for (int i = 0; i < 8; ++i) {
+    int dx = kQueenDirections[i][0];
+    int dy = kQueenDirections[i][1];
+    bool diagonal = dx != 0 && dy != 0;
+
+    for (int nx = x + dx, ny = y + dy, distance = 1; OnBoard(nx, ny); nx += dx, ny += dy, ++distance) {
+      Square square = board[Index(nx, ny)];
+
+      if (square == kEmpty) continue;
+
+      if (square == queen || (distance == 1 && square == king)) return true;
+      if (diagonal ? square == bishop : square == rook) return true;
+
+      break;
+    }
+  }
+
+  return false;
+}
+
+bool Position::KingInCheck() const {
+  if (kings_[player_] < 0) return false;
+
+  return IsAttacked(squares_.data(), kings_[player_], GetOpponent(player_));
+}
+
+bool Position::IsLegal(Move move) const {
+  // Play the move on a scratch board and check whether the king is attacked afterwards.
+  std::array<Square, kMaxSquares> board;
+  std::memcpy(board.data(), squares_.data(), width_ * height_ * sizeof(Square));
+
+  Square piece = board[move.from];
+  int king = GetFigure(piece) == Figure::kKing ? move.to : kings_[player_];
+
+  if (move.GetFlagCode() == 5) {
+    int direction = player_ == Player::kWhite ? 1 : -1;
+    board[Index(double_push_pawn_.x, double_push_pawn_.y - direction)] = kEmpty;
+  }
+
+  board[move.to] = piece;
+  board[move.from] = kEmpty;
+
+  if (king < 0) return true;
+
+  return !IsAttacked(board.data(), king, GetOpponent(player_));
+}
+
+void Position::GenMoves(MoveList *moves) const {
+  bool in_check = KingInCheck();
+
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      Square square = squares_[Index(x, y)];
+
+      if (square == kEmpty || GetOwner(square) != player_) continue;
+
+      switch (GetFigure(square)) {
+        case Figure::kPawn:
+          GenPawnMoves(x, y, moves);
+          break;
+        case Figure::kRook:
+          GenDirectionalMoves(x, y, kRookDirections, 4, kMaxWidth + kMaxHeight, moves);
+          break;
+        case Figure::kBishop:
+          GenDirectionalMoves(x, y, kBishopDirections, 4, kMaxWidth + kMaxHeight, moves);
+          break;
+        case Figure::kQueen:
+          GenDirectionalMoves(x, y, kQueenDirections, 8, kMaxWidth + kMaxHeight, moves);
+          break;
+        case Figure::kKnight:
+          GenDirectionalMoves(x, y, kKnightDirections, 8, 1, moves);
+          break;
+        case Figure::kKing:
+          GenDirectionalMoves(x, y, kQueenDirections, 8, 1, moves);
+          if (!in_check) GenCastlingMoves(x, y, moves);
+          break;
+        default:
+          assert(false);
+      }
+    }
+  }
+}
+
+void Position::GenPawnMoves(int x, int y, MoveList *moves) const {
+  int direction = player_ == Player::kWhite ? 1 : -1;
+  int ny = y + direction;
+
+  if (ny < 0 || ny >= height_) return;
+
+  std::uint16_t from = Index(x, y);
+  bool promotion = ny == height_ - 1 || ny == 0;
+
+  // Pushes. As in Game::GenPawnPushes, all pushes of a pawn reset the no progress counter only if a double push is
+  // possible as well.
+  Move pushes[5];
+  int push_count = 0;
+
+  if (squares_[Index(x, ny)] == kEmpty) {
+    std::uint16_t to = Index(x, ny);
+
+    if (promotion) {
+      for (int code : kPromotionCodes)
+        pushes[push_count++] = {from, to, static_cast<std::uint8_t>(Move::kPromotion | code)};
+    } else {
+      pushes[push_count++] = {from, to, 0};
+    }
+
+    int nny = y + 2 * direction;
+
+    if (nny >= 0 && nny < height_ && y == (player_ == Player::kWhite ? 1 : height_ - 2) &&
+        squares_[Index(x, nny)] == kEmpty) {
+      pushes[push_count++] = {from, static_cast<std::uint16_t>(Index(x, nny)), 1};
+
+      for (int i = 0; i < push_count; ++i) pushes[i].flags |= Move::kResetNoProgress;
+    }
+  }
+
+  for (int i = 0; i < push_count; ++i) {
+    if (IsLegal(pushes[i])) moves->Add(pushes[i]);
+  }
+
+  // Captures
+  for (int h : {-1, 1}) {
+    int nx = x + h;
+
+    if (nx < 0 || nx >= width_) continue;
+
+    std::uint16_t to = Index(nx, ny);
+    Square target = squares_[to];
+    std::uint8_t flags = Move::kCapture | Move::kResetNoProgress;
+
+    int ep_y = double_push_pawn_.y - direction;
+    if (double_push_pawn_.x == nx && double_push_pawn_.y == ny && ep_y >= 0 && ep_y < height_ &&
+        squares_[Index(nx, ep_y)] != kEmpty && GetOwner(squares_[Index(nx, ep_y)]) != player_) {
+      // En passant
+      flags |= 1;
+    } else if (target == kEmpty || GetOwner(target) == player_) {
+      continue;
+    }
+
+    if (!promotion) {
+      Move move{from, to, flags};
+
+      if (IsLegal(move)) moves->Add(move);
+
+      continue;
+    }
+
+    for (int code : kPromotionCodes) {
+      Move move{from, to, static_cast<std::uint8_t>(Move::kPromotion | Move::kCapture | Move::kResetNoProgress | code)};
+
+      if (IsLegal(move)) moves->Add(move);
+    }
+  }
+}
+
+void Position::GenDirectionalMoves(int x, int y, const int (*directions)[2], int direction_count, int range,
+                                   MoveList *moves) const {
+  std::uint16_t from = Index(x, y);
+
+  for (int i = 0; i < direction_count; ++i) {
+    for (int distance = 1; distance <= range; ++distance) {
+      int nx = x + distance * directions[i][0];
+      int ny = y + distance * directions[i][1];
+
+      if (!OnBoard(nx, ny)) break;
+
+      Square target = squares_[Index(nx, ny)];
+
+      if (target != kEmpty && GetOwner(target) == player_) break;
+
+      Move move{from, static_cast<std::uint16_t>(Index(nx, ny)), target == kEmpty ? std::uint8_t{0} : Move::kCapture};
+
+      if (IsLegal(move)) moves->Add(move);
+
+      if (target != kEmpty) break;
+    }
+  }
+}
+
+void Position::GetCastlingRooks(int *left_x, int *right_x) const {
+  *left_x = -1;
+  *right_x = -1;
+
+  int king = kings_[player_];
+
+  if (king < 0) return;
+
+  int king_x = king % width_;
+  int king_y = king / width_;
+
+  if (king_y > 0 && king_y < height_ - 1) return;
+
+  Square rook = MakeSquare(Figure::kRook, player_);
+  int left = -1;
+  int right = -1;
+
+  for (int x = 0; x < width_; ++x) {
+    if (squares_[Index(x, king_y)] != rook) continue;
+
+    // Take rooks closest to king
+    if (x < king_x) {
+      left = x;
+    } else {
+      right = x;
+      break;
+    }
+  }
+
+  if (castle_king_[player_]) *right_x = right;
+  if (castle_queen_[player_]) *left_x = left;
+}
+
+void Position::GenCastlingMoves(int x, int y, MoveList *moves) const {
+  if (width_ < 6 || width_ > 8) return;
+  if (y > 0 && y < height_ - 1) return;
+
+  int rooks[2];
+  GetCastlingRooks(&rooks[0], &rooks[1]);
+
+  // Attacks are computed with the king removed from the board.
+  std::array<Square, kMaxSquares> board;
+  std::memcpy(board.data(), squares_.data(), width_ * height_ * sizeof(Square));
+  board[Index(x, y)] = kEmpty;
+
+  Player opponent = GetOpponent(player_);
+
+  // King side (special code 2) and queen side (special code 3)
+  for (int side = 1; side >= 0; --side) {
+    int rook_x = rooks[side];
+    int direction = side == 1 ? 1 : -1;
+
+    if (rook_x < 0) continue;
+    if (!OnBoard(x + 2 * direction, y)) continue;
+
+    bool blocked = false;
+    for (int nx = x + direction; nx != rook_x; nx += direction) {
+      if (squares_[Index(nx, y)] != kEmpty) {
+        blocked = true;
+        break;
+      }
+    }
+
+    if (blocked) continue;
+
+    // The fields the king and the rook move to must not be attacked.
+    if (IsAttacked(board.data(), Index(x + 2 * direction, y), opponent)) continue;
+    if (rook_x != x + direction && IsAttacked(board.data(), Index(x + direction, y), opponent)) continue;
+
+    moves->Add({static_cast<std::uint16_t>(Index(x, y)), static_cast<std::uint16_t>(Index(x + 2 * direction, y)),
+                static_cast<std::uint8_t>(side == 1 ? 2 : 3)});
+  }
+}
+
+void Position::MakeMove(Move move) {
+  Square piece = squares_[move.from];
+  Figure figure = GetFigure(piece);
+  int code = move.GetFlagCode();
+  int direction = player_ == Player::kWhite ? 1 : -1;
+  bool castling = figure == Figure::kKing && (code == 2 || code == 3);
+
+  // The castling rook has to be looked up before the castling rights change.
+  int castling_rook_x = -1;
+  if (castling) {
+    int left_x, right_x;
+    GetCastlingRooks(&left_x, &right_x);
+
+    castling_rook_x = code == 2 ? right_x : left_x;
+  }
+
+  // Castling rights
+  if (figure == Figure::kKing) {
+    castle_king_[player_] = false;
+    castle_queen_[player_] = false;
+  } else if (figure == Figure::kRook) {
+    int left_x, right_x;
+    GetCastlingRooks(&left_x, &right_x);
+
+    int king_y = kings_[player_] / width_;
+
+    if (left_x >= 0 && move.from == Index(left_x, king_y)) castle_queen_[player_] = false;
+    if (right_x >= 0 && move.from == Index(right_x, king_y)) castle_king_[player_] = false;
+  }
+
+  Coord en_passant = double_push_pawn_;
+  double_push_pawn_ = {-1, -1};
+
+  int from_x = move.from % width_;
+  int from_y = move.from / width_;
+
+  if (castling) {
+    int side = code == 2 ? 1 : -1;
+    Square rook = squares_[Index(castling_rook_x, from_y)];
+
+    squares_[Index(castling_rook_x, from_y)] = kEmpty;
+    squares_[Index(from_x + side, from_y)] = rook;
+    squares_[move.from] = kEmpty;
+    squares_[move.to] = piece;
+  } else if (code & Move::kPromotion) {
+    squares_[move.from] = kEmpty;
+    squares_[move.to] = MakeSquare(GetPromotionFigure(code), player_);
+  } else {
+    if (code == 5) squares_[Index(en_passant.x, en_passant.y - direction)] = kEmpty;
+    if (figure == Figure::kPawn && code == 1) double_push_pawn_ = {from_x, from_y + direction};
+
+    squares_[move.from] = kEmpty;
+    squares_[move.to] = piece;
+  }
+
+  if (figure == Figure::kKing) kings_[player_] = move.to;
+
+  if (move.flags & Move::kResetNoProgress)
+    no_progress_count_ = 1;
+  else
+    ++no_progress_count_;
+
+  ++move_count_;
+  player_ = GetOpponent(player_);
+
+  last_move_ = move;
+  has_last_move_ = true;
+}
+
+int Position::GetMaterialBalance() const {
+  int balance = 0;
+
+  for (int i = 0; i < width_ * height_; ++i) {
+    Square square = squares_[i];
+
+    if (square == kEmpty) continue;
+
+    int value = kFigureValues[static_cast<int>(GetFigure(square))];
+
+    balance += GetOwner(square) == player_ ? value : -value;
+  }
+
+  return balance;
+}
+
+MoveInfo Position::GetMoveInfo(Move move) const {
+  Coord from{move.from % width_, move.from / width_};
+  Coord to{move.to % width_, move.to / width_};
+
+  return MoveInfo(from, to, (move.flags & Move::kPromotion) ? 1 : 0, (move.flags & Move::kCapture) ? 1 : 0,
+                  move.flags & Move::kSpecialMask);
+}
+
+State::StatePtr Position::ToState() const {
+  State::StatePtr state = std::make_shared<State>(width_, height_);
+  Board &board = state->GetBoard();
+
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      Square square = squares_[Index(x, y)];
+
+      if (square != kEmpty) board.SetField(x, y, make_piece(GetFigure(square), GetOwner(square)));
+    }
+  }
+
+  state->SetPlayer(player_);
+  for (auto player : {Player::kWhite, Player::kBlack}) {
+    // Note that these setters disable castling.
+    if (!castle_queen_[player]) state->SetCastleQueen(player);
+    if (!castle_king_[player]) state->SetCastleKing(player);
+  }
+  state->SetMoveCount(move_count_);
+  state->SetNoProgressCount(no_progress_count_);
+  state->SetDPushPawn(double_push_pawn_);
+
+  if (has_last_move_) state->move_info_ = std::make_shared<MoveInfo>(GetMoveInfo(last_move_));
+
+  return state;
+}
+
+}  // namespace chess
+}  // namespace aithena
@@ -0,0 +1,136 @@
+/*
+Copyright 2020 All rights reserved.
+*/
+
+#ifndef AITHENA_CHESS_POSITION_H_
+#define AITHENA_CHESS_POSITION_H_
+
+#include <array>
+#include <cstdint>
+
+#include "chess/piece.h"
+#include "chess/state.h"
+
+namespace aithena {
+namespace chess {
+
+// A move within a Position. The flags use the same encoding as MoveInfo (promotion << 3 | capture << 2 | special) with
+// an additional bit indicating that the move resets the no progress counter.
+struct Move {
+  std::uint16_t from;
+  std::uint16_t to;
+  std::uint8_t flags;
+
+  static const std::uint8_t kSpecialMask = 0x03;
+  static const std::uint8_t kCapture = 0x04;
+  static const std::uint8_t kPromotion = 0x08;
+  static const std::uint8_t kResetNoProgress = 0x10;
+
+  // Returns the flag code as used by MoveInfo::GetFlagCode.
+  int GetFlagCode() const { return flags & 0x0f; }
+};
+
+// A fixed-capacity list of moves, meant to be placed on the stack.
+class MoveList {
+ public:
+  static const int kCapacity = 2048;
+
+  void Add(Move move) {
+    if (size_ < kCapacity) moves_[size_++] = move;
+  }
+  void Clear() { size_ = 0; }
+  int Size() const { return size_; }
+
+  const Move &operator[](int i) const { return moves_[i]; }
+
+ private:
+  std::array<Move, kCapacity> moves_;
+  int size_{0};
+};
+
+// A compact, fixed-size chess position. Move generation and move making work on the position itself and never
+// allocate memory, which makes positions suitable for fast playouts. The rules follow chess::Game.
+class Position {
+ public:
+  static const int kMaxWidth = 26;
+  static const int kMaxHeight = 26;
+
+  // Initializes the position from a state.
+  explicit Position(State &state);
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+  Player GetPlayer() const { return player_; }
+  int GetMoveCount() const { return move_count_; }
+  int GetNoProgressCount() const { return no_progress_count_; }
+
+  // Returns the piece on field (x, y) or kEmptyPiece.
+  Piece GetField(int x, int y) const;
+
+  // Generates all legal moves for the player whose turn it is. Like Game::GenMoves, the move count and no progress
+  // limits are not taken into account.
+  void GenMoves(MoveList *moves) const;
+  // Applies a move returned by GenMoves.
+  void MakeMove(Move move);
+
+  // Returns whether the king of the player, whose turn it is, is in check.
+  bool KingInCheck() const;
+
+  // Returns the material balance from the perspective of the player whose turn it is (pawn = 1, knight = bishop = 3,
+  // rook = 5, queen = 9).
+  int GetMaterialBalance() const;
+
+  // Creates a state for this position. The move info is set from the last move applied via MakeMove.
+  State::StatePtr ToState() const;
+  // Creates the move info for a move.
+  MoveInfo GetMoveInfo(Move move) const;
+
+ private:
+  // Pieces are stored as 1 + player * figure_count + figure (0 for an empty square).
+  using Square = std::uint8_t;
+
+  static const int kMaxSquares = kMaxWidth * kMaxHeight;
+  static const Square kEmpty = 0;
+
+  static Square MakeSquare(Figure figure, Player player);
+  static Figure GetFigure(Square);
+  static Player GetOwner(Square);
+
+  int Index(int x, int y) const { return x + y * width_; }
+  bool OnBoard(int x, int y) const { return x >= 0 && x < width_ && y >= 0 && y < height_; }
+
+  // Returns whether the square at index is attacked by any piece of the given player on the given board.
+  bool IsAttacked(const Square *board, int index, Player attacker) const;
+  // Returns whether the move does not leave the moving player's king in check.
+  bool IsLegal(Move move) const;
+
+  void GenPawnMoves(int x, int y, MoveList *moves) const;
+  void GenDirectionalMoves(int x, int y, const int (*directions)[2], int direction_count, int range,
+                           MoveList *moves) const;
+  // Generates castling moves for the king at (x, y). Must not be called if the king is in check.
+  void GenCastlingMoves(int x, int y, MoveList *moves) const;
+
+  // Returns the x-coordinates of the rooks available for castling (-1 if none), see Game::GetCastlingRooks.
+  void GetCastlingRooks(int *left_x, int *right_x) const;
+
+  int width_;
+  int height_;
+  std::array<Square, kMaxSquares> squares_;
+  std::array<int, 2> kings_;
+
+  Player player_;
+  std::array<bool, 2> castle_queen_;
+  std::array<bool, 2> castle_king_;
+  int move_count_;
+  int no_progress_count_;
+  Coord double_push_pawn_;
+
+  // The last move applied via MakeMove
+  Move last_move_;
+  bool has_last_move_{false};
+};
+
+}  // namespace chess
+}  // namespace aithena
+
+#endif  // AITHENA_CHESS_POSITION_H_
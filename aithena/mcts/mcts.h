@@ -6,48 +6,163 @@ Copyright 2020 All rights reserved.
 #define AITHENA_MCTS_MCTS_H_
 
 #include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstddef>
 
 #include "benchmark/benchmark.h"
+#include "benchmark/search_report.h"
 #include "mcts/node.h"
+#include "mcts/policies.h"
+#include "mcts/rollout.h"
 
 namespace aithena {
 
-// Monte Carlo Tree Search
-class MCTS {
+// Limits the search for a single action. A value of 0 disables the respective limit. The search stops as soon as any of
+// the limits is reached.
+struct SearchBudget {
+  // Maximum number of simulations
+  int simulations{0};
+  // Maximum wall-clock time in milliseconds
+  long time{0};
+  // Maximum number of nodes in the search tree
+  long nodes{0};
+  // Maximum estimated memory usage of the search tree in bytes. Unlike the other limits, reaching it does not stop the
+  // search. Instead, the least visited subtrees are pruned and the search continues.
+  std::size_t memory{0};
+  // Whether to stop as soon as the most visited child can not be overtaken within the remaining budget. Disabled by
+  // default, so that a simulation limit alone runs exactly that many simulations.
+  bool early_stop{false};
+
+  // Returns whether at least one limit stopping the search is set.
+  bool IsLimited() const { return simulations > 0 || time > 0 || nodes > 0; }
+};
+
+// Limits the number of children of a node to max(1, ceil(coefficient * visits^exponent)) so that the search widens
+// gradually in positions with many moves. A coefficient of 0 disables the limit, i.e. all moves of a node are tried
+// before any of them is selected again.
+struct ProgressiveWidening {
+  double coefficient{0};
+  double exponent{0.5};
+
+  int GetMaxChildren(int visits) const {
+    if (coefficient <= 0) return INT_MAX;
+
+    double children = std::ceil(coefficient * std::pow(static_cast<double>(visits), exponent));
+
+    return children < 1 ? 1 : (children < INT_MAX ? static_cast<int>(children) : INT_MAX);
+  }
+};
+
+// Monte Carlo Tree Search with MCTS-Solver extension, parameterized by its selection, rollout and backup policies (see
+// mcts/policies.h and RolloutEngine). The member functions are defined in mcts/mcts_impl.h, which must be included to
+// instantiate the template with policies other than the ones of MCTS.
+template <typename Select, typename Rollout, typename Backup>
+class GenericMCTS {
  public:
-  MCTS(chess::Game::GamePtr game);
+  explicit GenericMCTS(chess::Game::GamePtr game);
 
+  // Returns the state that is the result of the action estimated to be the best for the current player. The search
+  // stops as soon as the position is proven (e.g. a forced mate is found), a proven win is always preferred. During a
+  // search session, the search tree is kept between calls and the search continues from the node matching the given
+  // state (see StartSession).
   chess::State::StatePtr DrawAction(chess::State::StatePtr);
+  chess::State::StatePtr DrawAction(chess::State::StatePtr, SearchBudget);
   MCTSNode::MCTSNodePtr DrawAction(MCTSNode::MCTSNodePtr);
+  MCTSNode::MCTSNodePtr DrawAction(MCTSNode::MCTSNodePtr, SearchBudget);
+
+  // Starts a search session. After each call to DrawAction(StatePtr), the subtree of the selected node is kept. If the
+  // next call passes one of its children (i.e. the opponent's reply), that grandchild becomes the new root and all
+  // other nodes are released.
+  void StartSession();
+  // Ends the search session and releases the search tree.
+  void EndSession();
+  bool InSession();
+  // Returns the node kept from the last call to DrawAction(StatePtr) or nullptr if there is none.
+  MCTSNode::MCTSNodePtr GetSessionRoot();
 
   void Simulate(MCTSNode::MCTSNodePtr);
 
-  // Selects the maximum child according to some evaluation function.
-  static MCTSNode::MCTSNodePtr SelectMax(MCTSNode::MCTSNodePtr node, double (*evaluate)(MCTSNode::MCTSNodePtr));
-
-  // Selects child according to UCT.
-  static MCTSNode::MCTSNodePtr UCTSelect(MCTSNode::MCTSNodePtr);
-  // Selects a random child.
-  static MCTSNode::MCTSNodePtr RandomSelect(MCTSNode::MCTSNodePtr);
-  // Selects child with highest visit count.
-  static MCTSNode::MCTSNodePtr VisitSelect(MCTSNode::MCTSNodePtr);
-
-  static void Backpass(MCTSNode::MCTSNodePtr, int);
+  // Returns the policies, e.g. to adjust their parameters.
+  Select &GetSelectPolicy() { return select_; }
+  Rollout &GetRolloutPolicy() { return rollout_; }
+  Backup &GetBackupPolicy() { return backup_; }
 
+  // Sets the budget to exactly the given number of simulations per action.
   void SetSimulations(int);
+  // Sets the budget used by DrawAction if none is given. If the budget is not limited, kDefaultSimulations are run.
+  void SetBudget(SearchBudget);
+  SearchBudget GetBudget();
+  void SetProgressiveWidening(ProgressiveWidening);
+  ProgressiveWidening GetProgressiveWidening();
+  // Sets the maximum number of moves per rollout (0 for no limit). Rollouts that reach the limit are scored by a static
+  // evaluation (see RolloutEngine::Evaluate). Requires the rollout policy to provide SetMaxDepth.
+  void SetRolloutDepth(int);
+
+  // Returns the number of simulations run by the last call to DrawAction.
+  int GetLastSimulations();
+  // Returns the number of nodes and the estimated memory usage in bytes of the tree searched by the last call to
+  // DrawAction or Simulate.
+  long GetTreeNodeCount();
+  std::size_t GetTreeMemoryUsage();
+  // Returns the number of nodes pruned by the last call to DrawAction to stay within the memory budget.
+  long GetPrunedNodeCount();
+  // Returns the telemetry of the last call to DrawAction.
+  SearchReport GetLastReport();
 
   const static int kDefaultSimulations = 1000;
+  // Fraction of the memory budget the tree is pruned to once the budget is exceeded
+  static constexpr double kPruneTarget = 0.75;
 
  private:
   chess::Game::GamePtr game_;
 
-  int simulations_{kDefaultSimulations};
-
-  MCTSNode::MCTSNodePtr (*select_policy_)(MCTSNode::MCTSNodePtr) = UCTSelect;
-  MCTSNode::MCTSNodePtr (*rollout_policy_)(MCTSNode::MCTSNodePtr) = RandomSelect;
-  void (*backpass_)(MCTSNode::MCTSNodePtr, int) = Backpass;
+  SearchBudget budget_{kDefaultSimulations, 0, 0, 0, false};
+  ProgressiveWidening widening_;
+
+  Select select_;
+  Rollout rollout_;
+  Backup backup_;
+
+  // Returns whether the search from the given node should stop after the given number of simulations.
+  bool IsBudgetExhausted(MCTSNode::MCTSNodePtr start, const SearchBudget &, int simulations,
+                         std::chrono::steady_clock::time_point search_start);
+  // Counts the nodes and estimates the memory of the tree below the given node.
+  void CountTree(MCTSNode::MCTSNodePtr);
+  // Collapses the least visited subtrees below the given node until the tree uses at most the given memory (or only
+  // the node and its children are left).
+  void Prune(MCTSNode::MCTSNodePtr start, std::size_t memory);
+
+  // Returns the proof for the exact result of a terminal node (from the perspective of the player who moved into it).
+  static MCTSNode::Proof ProofFromValue(double);
+  // Checks whether both states describe the same position, including the move counters.
+  static bool IsSameState(chess::State::StatePtr, chess::State::StatePtr);
+
+  // Returns the node of the session tree that matches the given state and makes it the new root. Returns nullptr if no
+  // such node exists.
+  MCTSNode::MCTSNodePtr AdvanceSession(chess::State::StatePtr);
+
+  int last_simulations_{0};
+  // Size of the searched tree, updated while simulating
+  long tree_node_count_{0};
+  std::size_t tree_memory_usage_{0};
+  // Number of nodes in the tree at the start of the current search
+  long initial_node_count_{0};
+  long pruned_node_count_{0};
+  // Telemetry of the current or last search, updated while simulating
+  SearchReport report_;
+
+  // Whether a search session is running
+  bool session_{false};
+  // The node selected by the last call to DrawAction(StatePtr) during a session
+  MCTSNode::MCTSNodePtr session_root_{nullptr};
 };
 
+// Monte Carlo Tree Search using UCT selection, random rollouts and discounted backups
+using MCTS = GenericMCTS<UCTSelection, RolloutEngine, DiscountedBackup>;
+
+extern template class GenericMCTS<UCTSelection, RolloutEngine, DiscountedBackup>;
+
 }  // namespace aithena
 
 #endif  // AITHENA_MCTS_MCTS_H_
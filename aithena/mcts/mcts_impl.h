@@ -0,0 +1,388 @@
+/*
+Copyright 2020 All rights reserved.
+*/
+
+#ifndef AITHENA_MCTS_MCTS_IMPL_H_
+#define AITHENA_MCTS_MCTS_IMPL_H_
+
+#include <float.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "chess/game.h"
+#include "mcts/mcts.h"
+
+namespace aithena {
+
+template <typename Select, typename Rollout, typename Backup>
+GenericMCTS<Select, Rollout, Backup>::GenericMCTS(chess::Game::GamePtr game) : game_{game}, rollout_{game} {}
+
+template <typename Select, typename Rollout, typename Backup>
+chess::State::StatePtr GenericMCTS<Select, Rollout, Backup>::DrawAction(chess::State::StatePtr state) {
+  return DrawAction(state, budget_);
+}
+
+template <typename Select, typename Rollout, typename Backup>
+chess::State::StatePtr GenericMCTS<Select, Rollout, Backup>::DrawAction(chess::State::StatePtr state,
+                                                                        SearchBudget budget) {
+  MCTSNode::MCTSNodePtr node = session_ ? AdvanceSession(state) : nullptr;
+
+  if (node == nullptr) node = std::make_shared<MCTSNode>(game_, state);
+
+  node = DrawAction(node, budget);
+
+  // Keep the subtree of the selected node, the rest of the tree is released together with the old root.
+  if (session_) session_root_ = node;
+
+  return node->GetState();
+}
+
+template <typename Select, typename Rollout, typename Backup>
+MCTSNode::MCTSNodePtr GenericMCTS<Select, Rollout, Backup>::DrawAction(MCTSNode::MCTSNodePtr start) {
+  return DrawAction(start, budget_);
+}
+
+template <typename Select, typename Rollout, typename Backup>
+MCTSNode::MCTSNodePtr GenericMCTS<Select, Rollout, Backup>::DrawAction(MCTSNode::MCTSNodePtr start,
+                                                                       SearchBudget budget) {
+  if (!budget.IsLimited()) budget.simulations = kDefaultSimulations;
+
+  auto search_start = std::chrono::steady_clock::now();
+
+  CountTree(start);
+  initial_node_count_ = tree_node_count_;
+  pruned_node_count_ = 0;
+  report_.Clear();
+
+  int simulations = 0;
+  do {
+    Simulate(start);
+    ++simulations;
+
+    if (budget.memory > 0 && tree_memory_usage_ > budget.memory)
+      Prune(start, static_cast<std::size_t>(kPruneTarget * static_cast<double>(budget.memory)));
+  } while (!IsBudgetExhausted(start, budget, simulations, search_start));
+
+  last_simulations_ = simulations;
+
+  report_.simulations = simulations;
+  report_.tree_nodes = tree_node_count_;
+  report_.tree_memory = tree_memory_usage_;
+  report_.time =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - search_start).count();
+
+  // Prefer proven wins and avoid proven losses, otherwise select the most visited child.
+  MCTSNode::MCTSNodePtr best = SelectMax(start, [](const MCTSNode::MCTSNodePtr &child) {
+    double visits = static_cast<double>(child->GetVisitCount());
+
+    if (child->GetProof() == MCTSNode::Proof::kWin) return DBL_MAX;
+    if (child->GetProof() == MCTSNode::Proof::kLoss) return -1.0 / (1.0 + visits);
+
+    return visits;
+  });
+
+  // With progressive widening, all tried moves may be proven losses while other moves were not tried yet. An untried
+  // move is preferred over a proven loss.
+  if (best->GetProof() == MCTSNode::Proof::kLoss &&
+      start->GetChildren().size() < static_cast<std::size_t>(start->GetActionCount())) {
+    std::size_t memory_usage = start->GetMemoryUsage();
+
+    best = start->ExpandChild();
+
+    tree_node_count_ += 1;
+    tree_memory_usage_ += start->GetMemoryUsage() - memory_usage + best->GetMemoryUsage();
+  }
+
+  return best;
+}
+
+template <typename Select, typename Rollout, typename Backup>
+bool GenericMCTS<Select, Rollout, Backup>::IsBudgetExhausted(MCTSNode::MCTSNodePtr start, const SearchBudget &budget,
+                                                             int simulations,
+                                                             std::chrono::steady_clock::time_point search_start) {
+  if (start->IsTerminal() || start->IsProven()) return true;
+
+  long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - search_start)
+                     .count();
+
+  if (budget.simulations > 0 && simulations >= budget.simulations) return true;
+  if (budget.time > 0 && elapsed >= budget.time) return true;
+  if (budget.nodes > 0 && tree_node_count_ >= budget.nodes) return true;
+
+  if (!budget.early_stop) return false;
+
+  const std::vector<MCTSNode::MCTSNodePtr> &children = start->GetChildren();
+
+  // Forced move
+  if (start->GetActionCount() == 1) return true;
+
+  // Estimate the number of remaining simulations for each limit based on the progress so far.
+  double progress = static_cast<double>(simulations);
+  double remaining = DBL_MAX;
+
+  if (budget.simulations > 0) remaining = std::min(remaining, static_cast<double>(budget.simulations - simulations));
+  if (budget.time > 0 && elapsed > 0) {
+    double rate = progress / static_cast<double>(elapsed);
+    remaining = std::min(remaining, rate * static_cast<double>(budget.time - elapsed));
+  }
+  if (budget.nodes > 0) {
+    long node_count = std::max(tree_node_count_ - initial_node_count_, 1L);
+    double rate = progress / static_cast<double>(node_count);
+    remaining = std::min(remaining, rate * static_cast<double>(budget.nodes - tree_node_count_));
+  }
+
+  // Stop once the runner-up could not catch up with the most visited child even if it received all remaining
+  // simulations.
+  int first{0}, second{0};
+  for (const auto &child : children) {
+    int visits = child->GetVisitCount();
+
+    if (visits > first) {
+      second = first;
+      first = visits;
+    } else if (visits > second) {
+      second = visits;
+    }
+  }
+
+  return static_cast<double>(first - second) > remaining;
+}
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::CountTree(MCTSNode::MCTSNodePtr start) {
+  tree_node_count_ = 0;
+  tree_memory_usage_ = 0;
+
+  std::vector<MCTSNode::MCTSNodePtr> stack{start};
+  while (!stack.empty()) {
+    MCTSNode::MCTSNodePtr node = stack.back();
+    stack.pop_back();
+
+    tree_node_count_ += 1;
+    tree_memory_usage_ += node->GetMemoryUsage();
+
+    for (auto child : node->GetChildren()) stack.push_back(child);
+  }
+}
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::Prune(MCTSNode::MCTSNodePtr start, std::size_t memory) {
+  // Expanded nodes whose children are all unexpanded
+  auto is_frontier = [](const MCTSNode::MCTSNodePtr &node) {
+    if (!node->IsExpanded()) return false;
+
+    for (const auto &child : node->GetChildren()) {
+      if (child->IsExpanded()) return false;
+    }
+
+    return true;
+  };
+  auto compare = [](const MCTSNode::MCTSNodePtr &a, const MCTSNode::MCTSNodePtr &b) {
+    return a->GetVisitCount() > b->GetVisitCount();
+  };
+
+  std::priority_queue<MCTSNode::MCTSNodePtr, std::vector<MCTSNode::MCTSNodePtr>, decltype(compare)> frontier(compare);
+
+  std::vector<MCTSNode::MCTSNodePtr> stack{start};
+  while (!stack.empty()) {
+    MCTSNode::MCTSNodePtr node = stack.back();
+    stack.pop_back();
+
+    if (node != start && is_frontier(node)) frontier.push(node);
+
+    for (const auto &child : node->GetChildren()) {
+      if (child->IsExpanded()) stack.push_back(child);
+    }
+  }
+
+  while (tree_memory_usage_ > memory && !frontier.empty()) {
+    MCTSNode::MCTSNodePtr node = frontier.top();
+    frontier.pop();
+
+    std::size_t released = node->GetMemoryUsage();
+    for (const auto &child : node->GetChildren()) released += child->GetMemoryUsage();
+    long children = static_cast<long>(node->GetChildren().size());
+
+    node->Collapse();
+
+    released -= node->GetMemoryUsage();
+    tree_memory_usage_ -= std::min(released, tree_memory_usage_);
+    tree_node_count_ -= children;
+    pruned_node_count_ += children;
+
+    MCTSNode::MCTSNodePtr parent = node->GetParent();
+    if (parent != nullptr && parent != start && is_frontier(parent)) frontier.push(parent);
+  }
+}
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::Simulate(MCTSNode::MCTSNodePtr start) {
+  PhaseTimer timer;
+  MCTSNode::MCTSNodePtr node = start;
+  int depth = 0;
+
+  // Selection
+
+  while (!node->IsLeaf(widening_.GetMaxChildren(node->GetVisitCount())) && !node->IsTerminal() && !node->IsProven()) {
+    node = select_.Select(node);
+    ++depth;
+  }
+
+  report_.selection_time += timer.Lap();
+
+  if (node->IsProven()) {
+    report_.AddDepth(depth);
+    backup_.Backup(node, node->GetProofValue());
+    report_.backup_time += timer.Lap();
+
+    return;
+  }
+
+  // Expansion
+
+  std::size_t memory_usage = node->GetMemoryUsage();
+
+  if (!node->IsExpanded()) node->Expand();
+
+  if (node->IsTerminal()) {
+    report_.expansion_time += timer.Lap();
+
+    int result = game_->GetStateResult(node->GetState());
+    node->SetProof(ProofFromValue(-result));
+
+    report_.AddDepth(depth);
+    backup_.Backup(node, -result);
+    report_.backup_time += timer.Lap();
+
+    return;
+  }
+
+  MCTSNode::MCTSNodePtr leaf = node->ExpandChild();
+
+  tree_node_count_ += 1;
+  tree_memory_usage_ += node->GetMemoryUsage() - memory_usage + leaf->GetMemoryUsage();
+  report_.nodes_allocated += 1;
+  report_.AddDepth(depth + 1);
+
+  report_.expansion_time += timer.Lap();
+
+  // Rollout
+
+  bool terminal{false};
+  double result = -rollout_.Rollout(leaf->GetState(), &terminal);
+
+  if (terminal) leaf->SetProof(ProofFromValue(result));
+
+  report_.evaluation_time += timer.Lap();
+
+  // Backpass
+
+  backup_.Backup(leaf, result);
+
+  report_.backup_time += timer.Lap();
+}
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::SetSimulations(int simulations) {
+  budget_ = {simulations, 0, 0, 0, false};
+}
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::SetBudget(SearchBudget budget) { budget_ = budget; }
+
+template <typename Select, typename Rollout, typename Backup>
+SearchBudget GenericMCTS<Select, Rollout, Backup>::GetBudget() { return budget_; }
+
+template <typename Select, typename Rollout, typename Backup>
+int GenericMCTS<Select, Rollout, Backup>::GetLastSimulations() { return last_simulations_; }
+
+template <typename Select, typename Rollout, typename Backup>
+long GenericMCTS<Select, Rollout, Backup>::GetTreeNodeCount() { return tree_node_count_; }
+
+template <typename Select, typename Rollout, typename Backup>
+std::size_t GenericMCTS<Select, Rollout, Backup>::GetTreeMemoryUsage() { return tree_memory_usage_; }
+
+template <typename Select, typename Rollout, typename Backup>
+long GenericMCTS<Select, Rollout, Backup>::GetPrunedNodeCount() { return pruned_node_count_; }
+
+template <typename Select, typename Rollout, typename Backup>
+SearchReport GenericMCTS<Select, Rollout, Backup>::GetLastReport() { return report_; }
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::SetProgressiveWidening(ProgressiveWidening widening) {
+  widening_ = widening;
+}
+
+template <typename Select, typename Rollout, typename Backup>
+ProgressiveWidening GenericMCTS<Select, Rollout, Backup>::GetProgressiveWidening() { return widening_; }
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::SetRolloutDepth(int depth) { rollout_.SetMaxDepth(depth); }
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::StartSession() {
+  session_ = true;
+  session_root_ = nullptr;
+}
+
+template <typename Select, typename Rollout, typename Backup>
+void GenericMCTS<Select, Rollout, Backup>::EndSession() {
+  session_ = false;
+  session_root_ = nullptr;
+}
+
+template <typename Select, typename Rollout, typename Backup>
+bool GenericMCTS<Select, Rollout, Backup>::InSession() { return session_; }
+
+template <typename Select, typename Rollout, typename Backup>
+MCTSNode::MCTSNodePtr GenericMCTS<Select, Rollout, Backup>::GetSessionRoot() { return session_root_; }
+
+template <typename Select, typename Rollout, typename Backup>
+MCTSNode::MCTSNodePtr GenericMCTS<Select, Rollout, Backup>::AdvanceSession(chess::State::StatePtr state) {
+  MCTSNode::MCTSNodePtr root = session_root_;
+  MCTSNode::MCTSNodePtr match{nullptr};
+
+  session_root_ = nullptr;
+
+  if (root == nullptr) return nullptr;
+
+  if (IsSameState(root->GetState(), state)) {
+    match = root;
+  } else {
+    for (auto child : root->GetChildren()) {
+      if (!IsSameState(child->GetState(), state)) continue;
+
+      match = child;
+      break;
+    }
+  }
+
+  // Detach the new root so that backpasses stop there.
+  if (match != nullptr) match->SetParent(nullptr);
+
+  return match;
+}
+
+template <typename Select, typename Rollout, typename Backup>
+MCTSNode::Proof GenericMCTS<Select, Rollout, Backup>::ProofFromValue(double value) {
+  if (value > 0) return MCTSNode::Proof::kWin;
+  if (value < 0) return MCTSNode::Proof::kLoss;
+
+  return MCTSNode::Proof::kDraw;
+}
+
+template <typename Select, typename Rollout, typename Backup>
+bool GenericMCTS<Select, Rollout, Backup>::IsSameState(chess::State::StatePtr a, chess::State::StatePtr b) {
+  if (a == b) return true;
+
+  return *a == *b && a->GetMoveCount() == b->GetMoveCount() && a->GetNoProgressCount() == b->GetNoProgressCount();
+}
+
+}  // namespace aithena
+
+#endif  // AITHENA_MCTS_MCTS_IMPL_H_
@@ -4,7 +4,13 @@ Copyright 2020 All rights reserved.
 
 #include "mcts/node.h"
 
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
+#include <utility>
 
 #include "chess/game.h"
 
@@ -17,7 +23,7 @@ MCTSNode::MCTSNode(chess::Game::GamePtr game, chess::State::StatePtr state, MCTS
 
 chess::State::StatePtr MCTSNode::GetState() { return state_; }
 MCTSNode::MCTSNodePtr MCTSNode::GetParent() { return parent_.lock(); }
-std::vector<MCTSNode::MCTSNodePtr> MCTSNode::GetChildren() { return children_; }
+const std::vector<MCTSNode::MCTSNodePtr> &MCTSNode::GetChildren() { return children_; }
 void MCTSNode::SetParent(MCTSNode::MCTSNodePtr parent) { parent_ = parent; }
 
 void MCTSNode::Update(double value) {
@@ -28,36 +34,106 @@ void MCTSNode::Update(double value) {
 void MCTSNode::Expand() {
   if (IsExpanded()) return;
 
-  MCTSNode::MCTSNodePtr node;
+  expanded_ = true;
 
-  auto moves = game_->GetLegalActions(state_);
-  for (auto move : moves) {
-    node = std::make_shared<MCTSNode>(game_, move, shared_from_this());
+  // Check for a draw, see Game::GetLegalActions
+  if (state_->GetNoProgressCount() >= game_->GetOption("max_no_progress") ||
+      state_->GetMoveCount() >= game_->GetOption("max_move_count"))
+    return;
 
-    children_.push_back(node);
-  }
+  chess::Position position(*state_);
+  chess::MoveList moves;
 
-  expanded_ = true;
+  position.GenMoves(&moves);
+
+  moves_.reserve(moves.Size());
+  for (int i = 0; i < moves.Size(); ++i) moves_.push_back(moves[i]);
+}
+
+MCTSNode::MCTSNodePtr MCTSNode::ExpandChild() {
+  assert(IsExpanded() && children_.size() < moves_.size());
+
+  // Move a random untried move to the front of the untried moves
+  std::size_t index = children_.size();
+  std::swap(moves_[index], moves_[index + rand() % (moves_.size() - index)]);
+
+  chess::Position position(*state_);
+  position.MakeMove(moves_[index]);
+
+  if (children_.capacity() == 0) children_.reserve(moves_.size());
+  children_.push_back(std::make_shared<MCTSNode>(game_, position.ToState(), shared_from_this()));
+
+  return children_.back();
+}
+
+void MCTSNode::Collapse() {
+  std::vector<MCTSNodePtr>().swap(children_);
+  std::vector<chess::Move>().swap(moves_);
+  expanded_ = false;
 }
 
 bool MCTSNode::IsExpanded() { return expanded_; }
 
-bool MCTSNode::IsLeaf() {
+bool MCTSNode::IsLeaf(int max_children) {
   if (!IsExpanded()) return true;
 
-  for (auto child : children_) {
-    if (child->GetVisitCount() <= 0) return true;
-  }
+  std::size_t children = children_.size();
+
+  if (children >= moves_.size()) return false;
+  if (children < static_cast<std::size_t>(max_children)) return true;
 
-  return false;
+  // Proven children are not selected, so an untried move is tried once all children are proven.
+  return std::all_of(children_.begin(), children_.end(), [](const MCTSNodePtr &child) { return child->IsProven(); });
 }
 
 bool MCTSNode::IsTerminal() {
-  if (IsExpanded()) return children_.size() <= 0;
+  if (IsExpanded()) return moves_.empty();
 
   return game_->IsTerminalState(GetState());
 }
 
+int MCTSNode::GetActionCount() { return static_cast<int>(moves_.size()); }
+
+MCTSNode::Proof MCTSNode::GetProof() { return proof_; }
+void MCTSNode::SetProof(Proof proof) { proof_ = proof; }
+bool MCTSNode::IsProven() { return proof_ != Proof::kUnknown; }
+
+double MCTSNode::GetProofValue() {
+  switch (proof_) {
+    case Proof::kWin:
+      return 1;
+    case Proof::kLoss:
+      return -1;
+    default:
+      return 0;
+  }
+}
+
+bool MCTSNode::UpdateProof() {
+  if (IsProven() || !IsExpanded() || children_.empty()) return false;
+
+  bool all_proven{true};
+  bool any_draw{false};
+  for (const auto &child : children_) {
+    Proof proof = child->GetProof();
+
+    // The player to move can win by moving to the child.
+    if (proof == Proof::kWin) {
+      proof_ = Proof::kLoss;
+      return true;
+    }
+
+    if (proof == Proof::kUnknown) all_proven = false;
+    if (proof == Proof::kDraw) any_draw = true;
+  }
+
+  if (!all_proven || children_.size() < moves_.size()) return false;
+
+  proof_ = any_draw ? Proof::kDraw : Proof::kWin;
+
+  return true;
+}
+
 double MCTSNode::GetMeanValue() {
   if (visit_count_ == 0) return 0;
 
@@ -66,4 +142,16 @@ double MCTSNode::GetMeanValue() {
 double MCTSNode::GetTotalValue() { return total_value_; }
 int MCTSNode::GetVisitCount() { return visit_count_; }
 
+std::size_t MCTSNode::GetMemoryUsage() {
+  Board &board = state_->GetBoard();
+
+  // Each board plane stores its bits in blocks of 64 bits.
+  std::size_t plane_size = sizeof(BoardPlane) + (board.GetWidth() * board.GetHeight() + 63) / 64 * sizeof(uint64_t);
+  std::size_t state_size = sizeof(chess::State) + 2 * board.GetFigureCount() * plane_size;
+  if (state_->move_info_ != nullptr) state_size += sizeof(chess::MoveInfo);
+
+  return sizeof(MCTSNode) + state_size + children_.capacity() * sizeof(MCTSNodePtr) +
+         moves_.capacity() * sizeof(chess::Move);
+}
+
 }  // namespace aithena
@@ -5,10 +5,13 @@ Copyright 2020 All rights reserved.
 #ifndef AITHENA_MCTS_NODE_H_
 #define AITHENA_MCTS_NODE_H_
 
+#include <climits>
+#include <cstddef>
 #include <memory>
 #include <vector>
 
 #include "chess/game.h"
+#include "chess/position.h"
 #include "game/game.h"
 
 namespace aithena {
@@ -17,34 +20,64 @@ class MCTSNode : public std::enable_shared_from_this<MCTSNode> {
  public:
   using MCTSNodePtr = std::shared_ptr<MCTSNode>;
 
+  // The game-theoretic value of a node proven by the search, from the perspective of the player who moved into the
+  // node.
+  enum class Proof { kUnknown, kWin, kLoss, kDraw };
+
   MCTSNode(chess::Game::GamePtr game, chess::State::StatePtr state, MCTSNodePtr parent = nullptr);
 
   chess::State::StatePtr GetState();
   MCTSNodePtr GetParent();
-  std::vector<MCTSNodePtr> GetChildren();
+  // Returns the children created so far (see ExpandChild).
+  const std::vector<MCTSNodePtr> &GetChildren();
   void SetParent(MCTSNodePtr);
 
   void Update(double);
+  // Generates the legal moves of the node. Children are not created until they are tried (see ExpandChild).
   void Expand();
+  // Creates the child for a random move that has not been tried yet and returns it. The node must be expanded and have
+  // untried moves.
+  MCTSNodePtr ExpandChild();
+  // Releases all children. Statistics and proofs are kept and the node is expanded again once the search reaches it.
+  void Collapse();
   bool IsExpanded();
-  bool IsLeaf();
+  // Returns whether the node is not expanded or has untried moves while having less than max_children children or only
+  // proven children.
+  bool IsLeaf(int max_children = INT_MAX);
   bool IsTerminal();
+  // Returns the number of legal moves of an expanded node.
+  int GetActionCount();
+
+  Proof GetProof();
+  void SetProof(Proof);
+  bool IsProven();
+  // Returns the value corresponding to the proof (1 win, -1 loss, 0 draw or unknown).
+  double GetProofValue();
+  // Derives the proof from the children: the node is lost if any child is won, won if all moves were tried and all
+  // children are lost and drawn if all children are proven otherwise. Returns whether the node became proven.
+  bool UpdateProof();
 
   double GetMeanValue();
   double GetTotalValue();
   int GetVisitCount();
 
+  // Returns an estimate of the memory in bytes used by this node, not including its children.
+  std::size_t GetMemoryUsage();
+
  private:
   // The game rules for chess
   chess::Game::GamePtr game_;
-  // The children nodes of this node.
+  // The children nodes of this node, in the order they were created.
   std::vector<MCTSNodePtr> children_{};
+  // The legal moves of an expanded node. The first children_.size() moves are the ones of the children.
+  std::vector<chess::Move> moves_{};
   // The parent node of this node.
   std::weak_ptr<MCTSNode> parent_;
   // The state encapsulated by this node.
   chess::State::StatePtr state_;
   // Whether the node has been expanded
   bool expanded_{false};
+  Proof proof_{Proof::kUnknown};
 
   double total_value_{0};
   int visit_count_{0};
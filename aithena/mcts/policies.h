@@ -0,0 +1,115 @@
+/*
+Copyright 2020 All rights reserved.
+*/
+
+#ifndef AITHENA_MCTS_POLICIES_H_
+#define AITHENA_MCTS_POLICIES_H_
+
+#include <assert.h>
+#include <float.h>
+
+#include <cmath>
+#include <cstdlib>
+
+#include "mcts/node.h"
+
+namespace aithena {
+
+// Policies for GenericMCTS. A selection policy provides
+//   MCTSNode::MCTSNodePtr Select(const MCTSNode::MCTSNodePtr &node)
+// returning one of the children of an expanded node. A backup policy provides
+//   void Backup(const MCTSNode::MCTSNodePtr &node, double value)
+// propagating a value (from the perspective of the player who moved into node) up to the root and updating the proofs
+// of the ancestors if node is proven (see MCTSNode::UpdateProof). For rollout policies see RolloutEngine.
+
+// Selects the maximum child according to some evaluation function. Ties are broken uniformly at random.
+template <typename Evaluate>
+inline MCTSNode::MCTSNodePtr SelectMax(const MCTSNode::MCTSNodePtr &node, Evaluate evaluate) {
+  double max_value{-DBL_MAX};
+  MCTSNode::MCTSNodePtr max_child{nullptr};
+  int max_count{0};
+
+  for (const auto &child : node->GetChildren()) {
+    double value = evaluate(child);
+
+    if (value < max_value) continue;
+
+    if (value > max_value) {
+      max_value = value;
+      max_child = child;
+      max_count = 1;
+      continue;
+    }
+
+    // Reservoir sampling among the children sharing the maximum value
+    if (rand() % ++max_count == 0) max_child = child;
+  }
+
+  assert(max_child != nullptr);
+
+  return max_child;
+}
+
+// Selects child according to UCT. Proven children are only selected if all children are proven.
+struct UCTSelection {
+  double exploration{1.41};
+
+  MCTSNode::MCTSNodePtr Select(const MCTSNode::MCTSNodePtr &node) const {
+    assert(node->GetVisitCount() > 0);
+
+    double log_parent_visits = std::log(static_cast<double>(node->GetVisitCount()));
+
+    return SelectMax(node, [this, log_parent_visits](const MCTSNode::MCTSNodePtr &child) {
+      if (child->IsProven()) return -DBL_MAX;
+
+      assert(child->GetVisitCount() > 0);
+
+      double exploitation = child->GetMeanValue();
+      double exploration_term = std::sqrt(log_parent_visits / static_cast<double>(child->GetVisitCount()));
+
+      return exploitation + exploration * exploration_term;
+    });
+  }
+};
+
+// Selects a random child.
+struct RandomSelection {
+  MCTSNode::MCTSNodePtr Select(const MCTSNode::MCTSNodePtr &node) const {
+    return SelectMax(node, [](const MCTSNode::MCTSNodePtr &) { return static_cast<double>(rand()) / RAND_MAX; });
+  }
+};
+
+// Selects child with highest visit count.
+struct VisitSelection {
+  MCTSNode::MCTSNodePtr Select(const MCTSNode::MCTSNodePtr &node) const {
+    return SelectMax(node,
+                     [](const MCTSNode::MCTSNodePtr &child) { return static_cast<double>(child->GetVisitCount()); });
+  }
+};
+
+// Adds the value to all nodes on the path to the root, alternating the sign for each player and discounting the value
+// by a constant factor per level. Proofs are propagated as long as the ancestors become proven.
+struct DiscountedBackup {
+  double discount{0.99};
+
+  void Backup(const MCTSNode::MCTSNodePtr &start, double value) const {
+    MCTSNode::MCTSNodePtr node = start;
+    bool proving = start->IsProven();
+
+    double factor = 1;
+    while (node != nullptr) {
+      node->Update(factor * value);
+
+      MCTSNode::MCTSNodePtr parent = node->GetParent();
+      if (proving && parent != nullptr) proving = parent->UpdateProof();
+
+      node = parent;
+      value = -value;
+      factor = factor * discount;
+    }
+  }
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_MCTS_POLICIES_H_
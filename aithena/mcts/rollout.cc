@@ -0,0 +1,59 @@
+/*
+Copyright 2020 All rights reserved.
+*/
+
+#include "mcts/rollout.h"
+
+#include <cmath>
+
+namespace aithena {
+
+RolloutEngine::RolloutEngine(chess::Game::GamePtr game)
+    : max_no_progress_{game->GetOption("max_no_progress")},
+      max_move_count_{game->GetOption("max_move_count")},
+      generator_{std::random_device{}()} {}
+
+double RolloutEngine::Rollout(chess::State::StatePtr state, bool *terminal) {
+  chess::Position position(*state);
+  chess::MoveList moves;
+
+  // The result from the perspective of the player whose turn it is in the current position
+  double result{0};
+  int depth{0};
+
+  while (true) {
+    if (position.GetNoProgressCount() >= max_no_progress_ || position.GetMoveCount() >= max_move_count_) break;
+
+    if (max_depth_ > 0 && depth >= max_depth_) {
+      result = Evaluate(position);
+      break;
+    }
+
+    moves.Clear();
+    position.GenMoves(&moves);
+
+    if (moves.Size() == 0) {
+      if (position.KingInCheck()) result = -1;
+      break;
+    }
+
+    std::uniform_int_distribution<int> distribution(0, moves.Size() - 1);
+    position.MakeMove(moves[distribution(generator_)]);
+    ++depth;
+  }
+
+  // The depth limit is at least one move, so a rollout without any move ended in a terminal state.
+  if (terminal != nullptr) *terminal = depth == 0;
+
+  return depth % 2 == 0 ? result : -result;
+}
+
+double RolloutEngine::Evaluate(const chess::Position &position) {
+  return std::tanh(static_cast<double>(position.GetMaterialBalance()) / 10.0);
+}
+
+void RolloutEngine::SetMaxDepth(int max_depth) { max_depth_ = max_depth; }
+
+int RolloutEngine::GetMaxDepth() { return max_depth_; }
+
+}  // namespace aithena
@@ -0,0 +1,48 @@
+/*
+Copyright 2020 All rights reserved.
+*/
+
+#ifndef AITHENA_MCTS_ROLLOUT_H_
+#define AITHENA_MCTS_ROLLOUT_H_
+
+#include <random>
+
+#include "chess/game.h"
+#include "chess/position.h"
+
+namespace aithena {
+
+// Plays out random games on a single chess::Position. Apart from creating the position, a rollout does not allocate
+// memory.
+class RolloutEngine {
+ public:
+  explicit RolloutEngine(chess::Game::GamePtr game);
+
+  // Plays random moves starting from the given state until the game ends or the maximum depth is reached. Returns the
+  // result from the perspective of the player whose turn it is in the given state (1 win, 0 draw, -1 loss). If the
+  // maximum depth is reached, the position is scored using Evaluate. If terminal is given, it is set to whether the
+  // given state itself is terminal (in which case the result is exact).
+  double Rollout(chess::State::StatePtr, bool *terminal = nullptr);
+
+  // Returns a static evaluation in (-1, 1) from the perspective of the player whose turn it is.
+  static double Evaluate(const chess::Position &);
+
+  // Sets the maximum number of moves played per rollout (0 for no limit).
+  void SetMaxDepth(int);
+  int GetMaxDepth();
+
+  const static int kDefaultMaxDepth = 0;
+
+ private:
+  // For faster access to the game options "max_no_progress" and "max_move_count"
+  int max_no_progress_;
+  int max_move_count_;
+
+  int max_depth_{kDefaultMaxDepth};
+
+  std::mt19937 generator_;
+};
+
+}  // namespace aithena
+
+#endif  // AITHENA_MCTS_ROLLOUT_H_
@@ -2,11 +2,25 @@
  * @Copyright 2020 All Rights Reserved
  */
 
+#include <float.h>
 #include <torch/torch.h>
 
+#include <algorithm>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "alphazero/alphazero.h"
+#include "alphazero/batch_loader.h"
+#include "alphazero/eval_cache.h"
+#include "alphazero/inference_server.h"
+#include "alphazero/policy_table.h"
+#include "alphazero/quantization.h"
+#include "alphazero/simd_network.h"
 #include "chess/game.h"
 #include "chess/util.h"
 #include "gtest/gtest.h"
@@ -56,6 +70,30 @@ TEST_F(AlphaZeroTest, TestNNInput) {
   }
 }
 
+TEST_F(AlphaZeroTest, TestBoardPlanes) {
+  auto state = chess::State::FromFEN("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+  auto node = std::make_shared<AZNode>(game_, state);
+
+  for (auto player : chess::Game::players) {
+    // Encode planes square by square, ordered and rotated towards the player
+    torch::Tensor expected = torch::zeros({12, 8, 8});
+    int plane = 0;
+    for (auto p : {player, chess::GetOpponent(player)}) {
+      for (auto figure : chess::Game::figures) {
+        for (auto coord : state->GetBoard().GetPlane(chess::make_piece(figure, p)).GetCoords())
+          expected.index_put_({plane, coord.x, coord.y}, 1);
+
+        ++plane;
+      }
+    }
+
+    if (player == chess::Player::kBlack) expected = expected.rot90(1, {1, 2}).rot90(1, {1, 2});
+
+    EXPECT_TRUE(node->GetBoardPlanes(player).equal(expected));
+    EXPECT_TRUE(node->GetBoardPlanes(player).equal(EncodeBoardPlanes(state, player)));
+  }
+}
+
 TEST_F(AlphaZeroTest, TestNNOutput) {
   auto state = chess::State::FromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
   auto node = std::make_shared<AZNode>(game_, state);
@@ -70,4 +108,585 @@ TEST_F(AlphaZeroTest, TestNNOutput) {
 
     EXPECT_NEAR(true_prior, prior, 1e-5);
   }
+
+  // The sparse target holds the values of the tried moves.
+  std::vector<std::pair<int64_t, float>> sparse_output = GetSparseNNOutput(node);
+  EXPECT_EQ(sparse_output.size(), node->GetChildCount());
+  EXPECT_TRUE(GetNNOutput(sparse_output, 8, 8).equal(output));
+}
+
+TEST_F(AlphaZeroTest, TestNNOutputs) {
+  std::vector<std::string> fens = {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                                   "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1"};
+
+  for (auto fen : fens) {
+    auto node = std::make_shared<AZNode>(game_, chess::State::FromFEN(fen));
+    node->Expand();
+
+    torch::Tensor output = torch::rand({1, GetNNOutputSize(game_), 8, 8});
+    std::vector<float> values = GetNNOutputs(output, node);
+    std::vector<float> normalized_values = GetNNOutputs(output, node, true);
+
+    auto children = node->GetChildren();
+    ASSERT_EQ(values.size(), children.size());
+
+    double sum = 0;
+    for (std::size_t i = 0; i < children.size(); ++i) {
+      EXPECT_NEAR(values[i], GetNNOutput(output, children[i]), 1e-6);
+      sum += normalized_values[i];
+    }
+
+    EXPECT_NEAR(sum, 1.0, 1e-5);
+  }
+}
+
+TEST(ResidualBlockTest, TestSkipConnection) {
+  auto options = torch::nn::Conv2dOptions(4, 4, 3).stride(1).padding(1).padding_mode(torch::kZeros);
+  torch::nn::Conv2d conv1(options);
+  torch::nn::Conv2d conv2(options);
+  ResidualBlock block(0, conv1, conv2);
+
+  torch::Tensor input = torch::randn({2, 4, 8, 8});
+  torch::Tensor expected = torch::relu(conv2(torch::relu(conv1(input))) + input);
+  torch::Tensor output = block(input);
+
+  EXPECT_TRUE(output.allclose(expected, 1e-5, 1e-6));
+  // The block adds its input to the output of the convolutions instead of returning the input.
+  EXPECT_FALSE(output.allclose(input));
+}
+
+TEST_F(AlphaZeroTest, TestPolicyTable) {
+  const PolicyTable &table = PolicyTable::Get(8, 8);
+
+  EXPECT_EQ(&table, &PolicyTable::Get(8, 8));
+  EXPECT_EQ(table.GetPlaneCount(), GetNNOutputSize(game_));
+
+  // (plane * width + x) * height + y: queen move north by two, knight move and knight underpromotion
+  EXPECT_EQ(table.GetIndex(chess::Player::kWhite, {4, 1}, {4, 3}), (25 * 8 + 4) * 8 + 1);
+  EXPECT_EQ(table.GetIndex(chess::Player::kWhite, {6, 0}, {5, 2}), (12 * 8 + 6) * 8 + 0);
+  EXPECT_EQ(table.GetIndex(chess::Player::kWhite, {0, 6}, {0, 7}, chess::Figure::kKnight), (1 * 8 + 0) * 8 + 6);
+
+  // Policy targets are decoded at the same indices
+  auto node = std::make_shared<AZNode>(game_, game_->GetInitialState());
+  for (int i = 0; i < 100; ++i) az_->Simulate(node);
+
+  torch::Tensor output = GetNNOutput(node);
+  for (auto child : node->GetChildren()) {
+    double prior = static_cast<double>(child->GetVisitCount()) / static_cast<double>(node->GetVisitCount());
+
+    EXPECT_NEAR(output.reshape({-1})[table.GetIndex(child->GetState())].item<double>(), prior, 1e-6);
+  }
+}
+
+TEST_F(AlphaZeroTest, TestPUCTSelect) {
+  auto node = std::make_shared<AZNode>(game_, game_->GetInitialState());
+  for (int i = 0; i < 50; ++i) az_->Simulate(node);
+
+  node->GetChild(0)->AddVirtualLoss();
+  node->GetChild(1)->AddVirtualLoss();
+
+  double max_value = -DBL_MAX;
+  for (auto child : node->GetChildren()) max_value = std::max(max_value, az_->PUCTValue(child));
+
+  EXPECT_DOUBLE_EQ(az_->PUCTValue(az_->PUCTSelect(node)), max_value);
+
+  // Edge statistics are stored in the parent's arrays and outlive the parent.
+  AZNode::AZNodePtr child = az_->PUCTSelect(node);
+  auto edges = node->GetChildStatistics();
+  int visits = child->GetVisitCount();
+  int total_visits = 0;
+  for (int visit_count : edges->visit_counts) total_visits += visit_count;
+
+  EXPECT_EQ(edges->visit_counts.size(), node->GetChildCount());
+  EXPECT_EQ(total_visits + 1, node->GetVisitCount());
+
+  node.reset();
+  EXPECT_EQ(child->GetVisitCount(), visits);
+}
+
+TEST_F(AlphaZeroTest, TestTreeReuse) {
+  // The evaluation cache counts the evaluated nodes of a search.
+  az_->SetEvalCache(std::make_shared<EvalCache>());
+  az_->SetSimulations(4);
+
+  auto root = std::make_shared<AZNode>(game_, game_->GetInitialState());
+  auto child = az_->DrawAction(root);
+
+  EXPECT_EQ(az_->GetLastReport().cache_lookups, 1 + 4);
+
+  std::weak_ptr<AZNode> sibling = root->GetChild(child == root->GetChild(0) ? 1 : 0);
+  int visits = child->GetVisitCount();
+
+  // Siblings are released, the chosen child keeps its statistics and subtree.
+  root->Collapse();
+
+  EXPECT_TRUE(sibling.expired());
+  EXPECT_FALSE(root->IsExpanded());
+  EXPECT_EQ(child->GetVisitCount(), visits);
+  EXPECT_TRUE(child->IsExpanded());
+
+  // The reused root is not evaluated again.
+  az_->DrawAction(child);
+  EXPECT_EQ(az_->GetLastReport().cache_lookups, 4);
+}
+
+TEST_F(AlphaZeroTest, TestBatchedSimulation) {
+  auto state = chess::State::FromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  auto node = std::make_shared<AZNode>(game_, state);
+
+  az_->Simulate(node);
+
+  int simulations = az_->SimulateBatch(node, 8);
+
+  EXPECT_GT(simulations, 0);
+  EXPECT_LE(simulations, 8);
+  EXPECT_EQ(node->GetVisitCount(), 1 + simulations);
+
+  // All virtual losses are removed after the backpass
+  EXPECT_EQ(node->GetVirtualLoss(), 0);
+  for (auto child : node->GetChildren()) EXPECT_EQ(child->GetVirtualLoss(), 0);
+
+  // A batched search runs exactly the configured number of simulations
+  az_->SetEvalBatchSize(8);
+
+  auto start = std::make_shared<AZNode>(game_, state);
+  az_->DrawAction(start);
+
+  EXPECT_EQ(start->GetVisitCount(), 50);
+}
+
+TEST_F(AlphaZeroTest, TestInferenceServer) {
+  AlphaZeroNet net(game_, 16, 1);
+  net->eval();
+
+  auto state = chess::State::FromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  auto node = std::make_shared<AZNode>(game_, state);
+  torch::Tensor input = GetNNInput(node);
+
+  auto expected = net->forward(input);
+
+  InferenceServer server(net, 4, 1000);
+
+  std::vector<std::thread> threads;
+  std::vector<InferenceServer::Output> outputs(8);
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&server, &outputs, input, i] { outputs[i] = server.Evaluate(input).get(); });
+  }
+  for (auto &thread : threads) thread.join();
+
+  for (auto &output : outputs) {
+    EXPECT_TRUE(std::get<0>(output).allclose(std::get<0>(expected), 1e-4, 1e-5));
+    EXPECT_TRUE(std::get<1>(output).allclose(std::get<1>(expected), 1e-4, 1e-5));
+  }
+
+  EXPECT_EQ(server.GetRequestCount(), 8);
+  EXPECT_LE(server.GetBatchCount(), 8);
+
+  // A search evaluates its inputs through the server
+  AlphaZero az(game_, net);
+  az.SetInferenceServer(std::make_shared<InferenceServer>(net));
+  az.SetSimulations(10);
+  az.DrawAction(state);
+
+  EXPECT_GT(az.GetInferenceServer()->GetRequestCount(), 0);
+
+  server.Stop();
+  EXPECT_FALSE(server.IsRunning());
 }
+
+TEST_F(AlphaZeroTest, TestPrepareForInference) {
+  AlphaZeroNet net(game_, 16, 2);
+
+  // Training passes update the running statistics of the batch normalizations.
+  for (int i = 0; i < 3; ++i) net->forward(torch::rand({4, AlphaZeroNetImpl::kInputSize, 8, 8}));
+  net->eval();
+
+  auto state = chess::State::FromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  torch::Tensor input = GetNNInput(std::make_shared<AZNode>(game_, state));
+
+  auto expected = net->forward(input);
+
+  AlphaZeroNet inference(net->PrepareForInference());
+  EXPECT_FALSE(inference->is_training());
+  EXPECT_EQ(inference->GetGeneration(), net->GetGeneration());
+
+  // The batch normalizations are folded into the convolutions.
+  for (auto &module : inference->modules())
+    EXPECT_EQ(std::dynamic_pointer_cast<torch::nn::BatchNorm2dImpl>(module), nullptr);
+
+  std::tuple<torch::Tensor, torch::Tensor> output;
+  {
+    torch::InferenceMode inference_mode;
+    output = inference->forward(input);
+  }
+
+  EXPECT_TRUE(std::get<0>(output).allclose(std::get<0>(expected), 1e-4, 1e-5));
+  EXPECT_TRUE(std::get<1>(output).allclose(std::get<1>(expected), 1e-4, 1e-5));
+
+  // The search rebuilds its copy once the weights changed.
+  AlphaZero az(game_, net);
+  AlphaZeroNet copy = az.GetInferenceNetwork();
+
+  EXPECT_EQ(az.GetInferenceNetwork().ptr(), copy.ptr());
+
+  net->IncrementGeneration();
+
+  EXPECT_NE(az.GetInferenceNetwork().ptr(), copy.ptr());
+  EXPECT_EQ(az.GetInferenceNetwork()->GetGeneration(), net->GetGeneration());
+}
+
+TEST_F(AlphaZeroTest, TestInferenceDtype) {
+  EXPECT_TRUE(SupportsInferenceDtype(torch::kFloat32));
+  EXPECT_TRUE(SupportsInferenceDtype(torch::kBFloat16, true));
+  EXPECT_FALSE(SupportsInferenceDtype(torch::kInt8));
+
+  // Inputs are encoded in the requested type.
+  auto state = chess::State::FromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  auto node = std::make_shared<AZNode>(game_, state);
+  torch::Tensor input = GetNNInput(node, 8, torch::kBFloat16);
+
+  EXPECT_EQ(input.scalar_type(), torch::kBFloat16);
+  EXPECT_TRUE(input.to(torch::kFloat32).equal(GetNNInput(node)));
+
+  // Only the inference copy is converted, the outputs remain float32.
+  AlphaZeroNet net(game_, 16, 1);
+  AlphaZero az(game_, net);
+  az.SetInferenceDtype(torch::kBFloat16);
+
+  torch::ScalarType expected = SupportsInferenceDtype(torch::kBFloat16) ? torch::kBFloat16 : torch::kFloat32;
+  AlphaZeroNet inference = az.GetInferenceNetwork();
+
+  EXPECT_EQ(inference->GetDtype(), expected);
+  EXPECT_EQ(net->GetDtype(), torch::kFloat32);
+
+  std::tuple<torch::Tensor, torch::Tensor> output;
+  {
+    torch::InferenceMode inference_mode;
+    output = inference->forward(input);
+  }
+
+  EXPECT_EQ(std::get<0>(output).scalar_type(), torch::kFloat32);
+  EXPECT_EQ(std::get<1>(output).scalar_type(), torch::kFloat32);
+
+  az.SetSimulations(4);
+  az.DrawAction(state);
+
+  EXPECT_EQ(az.GetLastReport().simulations, 4);
+}
+
+TEST_F(AlphaZeroTest, TestQuantization) {
+  if (!SupportsQuantization()) return;
+
+  auto replay_memory = std::make_shared<ReplayMemory>();
+  for (auto fen : {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                   "rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2",
+                   "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3", "7k/8/8/8/8/8/8/K7 b - - 0 1"}) {
+    auto node = std::make_shared<AZNode>(game_, chess::State::FromFEN(fen));
+    replay_memory->AddSample(GetNNInput(node), torch::zeros({1, GetNNOutputSize(game_), 8, 8}), 0);
+  }
+
+  AlphaZeroNet net(game_, 16, 2);
+  AlphaZero az(game_, net, replay_memory);
+  az.SetQuantization(true);
+
+  // The quantized copy keeps the float interface.
+  AlphaZeroNet quantized = az.GetInferenceNetwork();
+  EXPECT_EQ(quantized->GetGeneration(), net->GetGeneration());
+
+  torch::Tensor input = std::get<0>(replay_memory->GetSample());
+
+  std::tuple<torch::Tensor, torch::Tensor> output;
+  {
+    torch::InferenceMode inference_mode;
+    output = quantized->forward(input);
+  }
+
+  EXPECT_EQ(std::get<0>(output).scalar_type(), torch::kFloat32);
+  EXPECT_EQ(std::get<0>(output).sizes(), torch::IntArrayRef({1, GetNNOutputSize(game_), 8, 8}));
+  EXPECT_EQ(std::get<1>(output).size(0), 1);
+
+  QuantizationReport report = az.GetQuantizationReport();
+
+  EXPECT_EQ(report.samples, AlphaZero::kQuantizationSampleCount);
+  EXPECT_GE(report.policy_agreement, 0.0);
+  EXPECT_LE(report.policy_agreement, 1.0);
+  EXPECT_LT(report.value_error, 0.2);
+  EXPECT_GT(report.GetSpeedup(), 0.0);
+
+  az.SetSimulations(4);
+  az.DrawAction(chess::State::FromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+
+  EXPECT_EQ(az.GetLastReport().simulations, 4);
+}
+
+TEST_F(AlphaZeroTest, TestSimdNetwork) {
+  chess::Game::Options options = {{"board_width", 5}, {"board_height", 5}};
+  auto game = std::make_shared<chess::Game>(options);
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+
+  AlphaZeroNet net(game, 16, 2);
+  EXPECT_TRUE(SimdNetwork::IsSupported(5, 5, 16));
+  EXPECT_FALSE(SimdNetwork::IsSupported(5, 5, 24));
+  EXPECT_THROW(net->GetSimdNetworkWeights(8, 8), std::invalid_argument);
+
+  std::unique_ptr<SimdNetwork> simd_network = SimdNetwork::Create(net->GetSimdNetworkWeights(5, 5));
+  ASSERT_NE(simd_network, nullptr);
+  EXPECT_EQ(simd_network->GetPolicyPlanes(), GetNNOutputSize(game));
+
+  torch::Tensor input = torch::cat({GetNNInput(std::make_shared<AZNode>(game, state)),
+                                    torch::rand({1, AlphaZeroNetImpl::kInputSize, 5, 5})});
+
+  std::tuple<torch::Tensor, torch::Tensor> expected;
+  {
+    torch::InferenceMode inference_mode;
+    expected = net->PrepareForInference()->forward(input);
+  }
+
+  torch::Tensor action_values = torch::empty({2, GetNNOutputSize(game), 5, 5});
+  torch::Tensor state_values = torch::empty({2});
+  simd_network->Forward(input.contiguous().data_ptr<float>(), 2, action_values.data_ptr<float>(),
+                        state_values.data_ptr<float>());
+
+  EXPECT_TRUE(action_values.allclose(std::get<0>(expected), 1e-3, 1e-4));
+  EXPECT_TRUE(state_values.allclose(std::get<1>(expected), 1e-3, 1e-4));
+
+  // The search evaluates the SimdNetwork.
+  AlphaZero az(game, net);
+  az.SetSimdInference(true);
+  az.SetSimulations(4);
+  az.DrawAction(state);
+
+  EXPECT_EQ(az.UsesSimdInference(), !net->UsesCUDA());
+  EXPECT_EQ(az.GetLastReport().simulations, 4);
+}
+
+TEST(ReplayMemoryTest, TestRingBuffer) {
+  ReplayMemory replay_memory(0, 300);
+
+  EXPECT_THROW(replay_memory.GetBatch(1), std::out_of_range);
+
+  // Sample i has input, action values and state value i. The storage grows past its initial capacity and wraps around.
+  for (int i = 0; i < 500; ++i) {
+    float value = static_cast<float>(i);
+    replay_memory.AddSample(torch::full({1, 2, 5, 5}, value), torch::full({1, 3, 5, 5}, value), value);
+  }
+
+  EXPECT_EQ(replay_memory.GetSampleCount(), 300);
+
+  ReplayMemory::Batch batch = replay_memory.GetBatch(64);
+  torch::Tensor inputs = std::get<0>(batch);
+  torch::Tensor action_values = std::get<1>(batch);
+  torch::Tensor state_values = std::get<2>(batch);
+
+  EXPECT_EQ(inputs.sizes(), torch::IntArrayRef({64, 2, 5, 5}));
+  EXPECT_EQ(action_values.sizes(), torch::IntArrayRef({64, 3, 5, 5}));
+  EXPECT_EQ(state_values.sizes(), torch::IntArrayRef({64}));
+  EXPECT_EQ(state_values.scalar_type(), torch::kFloat32);
+
+  // Only the newest samples are kept and the tensors of a sample stay together.
+  EXPECT_GE(state_values.min().item<double>(), 200);
+  EXPECT_TRUE(inputs.amax({1, 2, 3}).equal(state_values));
+  EXPECT_TRUE(action_values.amin({1, 2, 3}).equal(state_values));
+
+  replay_memory.SetMaxSize(100);
+  EXPECT_EQ(replay_memory.GetSampleCount(), 100);
+  EXPECT_GE(std::get<2>(replay_memory.GetBatch(64)).min().item<double>(), 400);
+
+  replay_memory.AddSample(torch::full({1, 2, 5, 5}, 500.0f), torch::full({1, 3, 5, 5}, 500.0f), 500.0);
+  EXPECT_EQ(replay_memory.GetSampleCount(), 100);
+  EXPECT_GE(std::get<2>(replay_memory.GetBatch(64)).min().item<double>(), 401);
+
+  ReplayMemory::Sample sample = replay_memory.GetSample();
+  EXPECT_EQ(std::get<0>(sample).sizes(), torch::IntArrayRef({1, 2, 5, 5}));
+  EXPECT_EQ(std::get<0>(sample).max().item<double>(), std::get<1>(std::get<1>(sample)));
+}
+
+TEST_F(AlphaZeroTest, TestCompactReplayMemory) {
+  ReplayMemory replay_memory(0, 1000);
+
+  auto node = std::make_shared<AZNode>(
+      game_, chess::State::FromFEN("r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3"));
+  torch::Tensor input = GetNNInput(node);
+
+  // A sparse policy as produced by the search
+  torch::Tensor action_values = torch::zeros({1, GetNNOutputSize(game_), 8, 8});
+  action_values.view({-1}).narrow(0, 100, 30).fill_(1.0 / 30);
+  action_values.view({-1})[0] = 0.5;
+
+  for (int i = 0; i < 1000; ++i) replay_memory.AddSample(input, action_values, 1.0);
+
+  // Samples are restored exactly.
+  ReplayMemory::Sample sample = replay_memory.GetSample();
+  EXPECT_TRUE(std::get<0>(sample).equal(input));
+  EXPECT_TRUE(std::get<0>(std::get<1>(sample)).equal(action_values));
+  EXPECT_EQ(std::get<1>(std::get<1>(sample)), 1.0);
+
+  // Batches are decoded into the given buffers, overwriting their contents.
+  ReplayMemory::Batch batch = replay_memory.AllocateBatch(4);
+  void *buffer = std::get<0>(batch).data_ptr();
+  std::get<0>(batch).fill_(7);
+  std::get<1>(batch).fill_(7);
+
+  replay_memory.GetBatch(&batch);
+  EXPECT_EQ(std::get<0>(batch).data_ptr(), buffer);
+  EXPECT_TRUE(std::get<0>(batch).equal(input.expand({4, -1, -1, -1})));
+  EXPECT_TRUE(std::get<1>(batch).equal(action_values.expand({4, -1, -1, -1})));
+
+  int64_t dense_size = 1000 * (input.numel() + action_values.numel() + 1) * 4;
+  EXPECT_LT(replay_memory.GetStorageSize() * 10, dense_size);
+
+  // Planes must have a single non-zero value.
+  torch::Tensor invalid = input.clone();
+  invalid[0][0][0][0] = 2;
+  EXPECT_THROW(replay_memory.AddSample(invalid, action_values, 0.0), std::invalid_argument);
+  EXPECT_EQ(replay_memory.GetSampleCount(), 1000);
+}
+
+TEST(ReplayMemoryTest, TestBatchLoader) {
+  auto replay_memory = std::make_shared<ReplayMemory>();
+  BatchLoader loader(replay_memory, 16);
+
+  // The worker waits for the first sample.
+  for (int i = 0; i < 100; ++i) {
+    float value = static_cast<float>(i);
+    replay_memory->AddSample(torch::full({1, 2, 5, 5}, value), torch::full({1, 3, 5, 5}, value), value);
+  }
+
+  for (int i = 0; i < 10; ++i) {
+    ReplayMemory::Batch batch = loader.Next();
+
+    EXPECT_EQ(std::get<0>(batch).sizes(), torch::IntArrayRef({16, 2, 5, 5}));
+    EXPECT_EQ(std::get<1>(batch).sizes(), torch::IntArrayRef({16, 3, 5, 5}));
+    EXPECT_TRUE(std::get<0>(batch).amax({1, 2, 3}).equal(std::get<2>(batch)));
+    EXPECT_TRUE(std::get<1>(batch).amin({1, 2, 3}).equal(std::get<2>(batch)));
+  }
+
+  EXPECT_EQ(loader.GetBatchCount(), 10);
+  EXPECT_LE(loader.GetStallCount(), 10);
+
+  loader.Stop();
+}
+
+TEST_F(AlphaZeroTest, TestTrainNetwork) {
+  chess::Game::Options options = {{"board_width", 5}, {"board_height", 5}};
+  auto game = std::make_shared<chess::Game>(options);
+  auto node = std::make_shared<AZNode>(game, chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1"));
+
+  auto replay_memory = std::make_shared<ReplayMemory>();
+
+  AlphaZero az(game, AlphaZeroNet(game, 16, 1), replay_memory);
+  az.SetUseCUDA(false);
+  az.SetBatchSize(8);
+  az.SetTrainingSteps(3);
+  az.SetGradientAccumulation(2);
+
+  // Training needs samples.
+  EXPECT_THROW(az.TrainNetwork(), std::out_of_range);
+
+  for (int i = 0; i < 8; ++i)
+    replay_memory->AddSample(GetNNInput(node), torch::full({1, GetNNOutputSize(game), 5, 5}, 0.01), i % 2 ? 1 : -1);
+
+  torch::Tensor weight = az.GetNetwork()->parameters()[0].clone();
+  long generation = az.GetNetwork()->GetGeneration();
+
+  az.TrainNetwork();
+
+  // All steps of a call form one generation.
+  EXPECT_EQ(az.GetNetwork()->GetGeneration(), generation + 1);
+  EXPECT_FALSE(az.GetNetwork()->parameters()[0].equal(weight));
+
+  // The network is loaded together with the optimizer state, so training continues where it stopped.
+  std::string path = testing::TempDir() + "aithena-test-train-network";
+  az.Save(path);
+
+  AlphaZero loaded(game, AlphaZeroNet(game, 16, 1), replay_memory);
+  loaded.SetUseCUDA(false);
+  loaded.Load(path);
+
+  for (std::size_t i = 0; i < az.GetNetwork()->parameters().size(); ++i)
+    EXPECT_TRUE(loaded.GetNetwork()->parameters()[i].equal(az.GetNetwork()->parameters()[i]));
+
+  EXPECT_TRUE(std::ifstream(path + "-optimizer.pt").good());
+
+  loaded.SetBatchSize(8);
+  loaded.TrainNetwork();
+}
+
+TEST_F(AlphaZeroTest, TestParallelSelfPlay) {
+  chess::Game::Options options = {{"board_width", 5}, {"board_height", 5}, {"max_move_count", 6}};
+  auto game = std::make_shared<chess::Game>(options);
+  auto replay_memory = std::make_shared<ReplayMemory>();
+
+  AlphaZero az(game, AlphaZeroNet(game, 16, 1), replay_memory);
+  az.SetSimulations(4);
+
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+  az.ParallelSelfPlay(4, 2, state);
+
+  // Each game stores one sample per position, i.e. at most 7 positions with 6 moves
+  EXPECT_GE(replay_memory->GetSampleCount(), 4 * 2);
+  EXPECT_LE(replay_memory->GetSampleCount(), 4 * 7);
+}
+
+TEST_F(AlphaZeroTest, TestEvalCache) {
+  auto state = chess::State::FromFEN("7k/8/8/8/8/8/8/K7 w - - 0 1");
+  auto other_state = chess::State::FromFEN("6k1/8/8/8/8/8/8/K7 w - - 0 1");
+
+  auto node = std::make_shared<AZNode>(game_, state);
+  auto same_node = std::make_shared<AZNode>(game_, chess::State::FromFEN("7k/8/8/8/8/8/8/K7 w - - 0 1"));
+  auto other_node = std::make_shared<AZNode>(game_, other_state);
+  auto child_node = std::make_shared<AZNode>(game_, state, other_node);
+
+  // Keys depend on the position and its history
+  EXPECT_EQ(EvalCache::GetKey(node, 8), EvalCache::GetKey(same_node, 8));
+  EXPECT_NE(EvalCache::GetKey(node, 8), EvalCache::GetKey(other_node, 8));
+  EXPECT_NE(EvalCache::GetKey(node, 8), EvalCache::GetKey(child_node, 8));
+  EXPECT_EQ(EvalCache::GetKey(node, 1), EvalCache::GetKey(child_node, 1));
+
+  // and on whether en-passant captures are possible
+  auto en_passant = chess::State::FromFEN("4k3/8/8/8/3pP3/8/8/4K3 b - e3 0 1");
+  auto no_en_passant = chess::State::FromFEN("4k3/8/8/8/3pP3/8/8/4K3 b - - 0 1");
+  EXPECT_NE(EvalCache::GetKey(std::make_shared<AZNode>(game_, en_passant), 8),
+            EvalCache::GetKey(std::make_shared<AZNode>(game_, no_en_passant), 8));
+
+  EvalCache cache(64, 4);
+  EXPECT_EQ(cache.GetCapacity(), 64u);
+
+  double value;
+  std::vector<float> priors;
+  std::uint64_t key = EvalCache::GetKey(node, 8);
+
+  EXPECT_FALSE(cache.Lookup(key, 0, 2, &value, &priors));
+
+  cache.Store(key, 0, 0.5, {0.25, 0.75});
+  ASSERT_TRUE(cache.Lookup(key, 0, 2, &value, &priors));
+  EXPECT_DOUBLE_EQ(value, 0.5);
+  ASSERT_EQ(priors.size(), 2u);
+  EXPECT_FLOAT_EQ(priors[1], 0.75);
+
+  // Entries of older network weights are stale
+  EXPECT_FALSE(cache.Lookup(key, 1, 2, &value, &priors));
+  // Entries with priors for a different number of moves belong to another position
+  EXPECT_FALSE(cache.Lookup(key, 0, 3, &value, &priors));
+  EXPECT_EQ(cache.GetLookupCount(), 4);
+  EXPECT_EQ(cache.GetHitCount(), 1);
+  EXPECT_DOUBLE_EQ(cache.GetHitRate(), 1.0 / 4.0);
+
+  // The root of consecutive searches from the same position is evaluated once
+  auto shared_cache = std::make_shared<EvalCache>();
+  az_->SetEvalCache(shared_cache);
+  az_->SetSimulations(8);
+
+  az_->DrawAction(state);
+  az_->DrawAction(state);
+
+  EXPECT_GT(az_->GetLastReport().cache_hits, 0);
+  EXPECT_GT(shared_cache->GetHitCount(), 0);
+
+  long hits = shared_cache->GetHitCount();
+  az_->GetNetwork()->IncrementGeneration();
+  az_->SetSimulations(1);
+  az_->DrawAction(state);
+
+  EXPECT_EQ(shared_cache->GetHitCount(), hits);
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+/*
+Copyright 2020 All rights reserved.
+*/
+#include <memory>
+#include <set>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "chess/game.h"
+#include "chess/position.h"
+
+using namespace aithena;
+
+class ChessPositionTest : public ::testing::Test {
+ protected:
+  // Checks that the position generates the same successor states as the game up to the given depth.
+  void VerifySameMoves(chess::State::StatePtr state, int depth);
+
+  // Describes a state including its counters and move info.
+  static std::string Describe(chess::State::StatePtr state);
+};
+
+std::string ChessPositionTest::Describe(chess::State::StatePtr state) {
+  std::string description = state->ToFEN() + " " + std::to_string(state->GetMoveCount());
+
+  if (state->move_info_ != nullptr) description += " " + state->ToLAN();
+
+  return description;
+}
+
+void ChessPositionTest::VerifySameMoves(chess::State::StatePtr state, int depth) {
+  if (depth == 0) return;
+
+  chess::Game::Options options = {{"board_width", state->GetBoard().GetWidth()},
+                                  {"board_height", state->GetBoard().GetHeight()},
+                                  {"max_move_count", 1000},
+                                  {"max_no_progress", 1000}};
+  chess::Game game(options);
+  chess::Game::StateList actions = game.GenMoves(state);
+
+  chess::Position position(*state);
+  chess::MoveList moves;
+  position.GenMoves(&moves);
+
+  EXPECT_EQ(position.KingInCheck(), game.KingInCheck(state)) << state->ToFEN();
+
+  std::multiset<std::string> expected;
+  for (auto action : actions) expected.insert(Describe(action));
+
+  std::multiset<std::string> actual;
+  for (int i = 0; i < moves.Size(); ++i) {
+    chess::Position next = position;
+    next.MakeMove(moves[i]);
+    actual.insert(Describe(next.ToState()));
+  }
+
+  ASSERT_EQ(actual, expected) << state->ToFEN();
+
+  for (auto action : actions) VerifySameMoves(action, depth - 1);
+}
+
+TEST_F(ChessPositionTest, SameMovesAsGame) {
+  std::tuple<std::string, int> positions[] = {
+      std::make_tuple("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 2),
+      std::make_tuple("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 2),
+      std::make_tuple("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 3),
+      std::make_tuple("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 2),
+      std::make_tuple("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 2),
+      std::make_tuple("n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1", 2),
+      std::make_tuple("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1", 3)};
+
+  for (auto position : positions) {
+    auto state = chess::State::FromFEN(std::get<0>(position));
+    ASSERT_NE(state, nullptr);
+
+    VerifySameMoves(state, std::get<1>(position));
+  }
+}
+
+TEST_F(ChessPositionTest, MaterialBalance) {
+  auto state = chess::State::FromFEN("4k3/8/8/8/8/8/PPP5/RN2K3 b - - 0 1");
+  chess::Position position(*state);
+
+  EXPECT_EQ(position.GetMaterialBalance(), -11);
+}
@@ -0,0 +1,338 @@
+/**
+ * @Copyright 2020 All Rights Reserved
+ */
+
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <vector>
+
+#include "chess/game.h"
+#include "gtest/gtest.h"
+#include "mcts/mcts.h"
+#include "mcts/mcts_impl.h"
+
+using namespace aithena;
+
+class MCTSTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    chess::Game::Options options = {{"board_width", 5}, {"board_height", 5}, {"max_move_count", 40}};
+    game_ = std::make_shared<chess::Game>(options);
+    mcts_ = std::make_shared<MCTS>(game_);
+
+    mcts_->SetSimulations(50);
+  }
+
+  chess::Game::GamePtr game_;
+  std::shared_ptr<MCTS> mcts_;
+};
+
+TEST_F(MCTSTest, TestSessionReusesGrandchild) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+
+  mcts_->StartSession();
+
+  auto next_state = mcts_->DrawAction(state);
+  MCTSNode::MCTSNodePtr root = mcts_->GetSessionRoot();
+
+  ASSERT_NE(root, nullptr);
+  EXPECT_EQ(root->GetState(), next_state);
+  ASSERT_GT(root->GetChildren().size(), 0);
+
+  // Opponent's reply with the most statistics
+  MCTSNode::MCTSNodePtr reply = root->GetChildren().at(0);
+  for (auto child : root->GetChildren()) {
+    if (child->GetVisitCount() > reply->GetVisitCount()) reply = child;
+  }
+
+  int visits = reply->GetVisitCount();
+
+  root = nullptr;
+  mcts_->DrawAction(std::make_shared<chess::State>(*reply->GetState()));
+
+  EXPECT_EQ(reply->GetParent(), nullptr);
+  EXPECT_EQ(reply->GetVisitCount(), visits + 50);
+
+  mcts_->EndSession();
+
+  EXPECT_FALSE(mcts_->InSession());
+  EXPECT_EQ(mcts_->GetSessionRoot(), nullptr);
+}
+
+TEST_F(MCTSTest, TestNoReuseWithoutSession) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+
+  mcts_->DrawAction(state);
+
+  EXPECT_EQ(mcts_->GetSessionRoot(), nullptr);
+}
+
+TEST_F(MCTSTest, TestRolloutTerminalState) {
+  RolloutEngine rollout(game_);
+
+  // Black is checkmated
+  auto mate = chess::State::FromFEN("k1R2/5/1K3/5/5 b - - 0 1");
+  EXPECT_EQ(rollout.Rollout(mate), -1);
+
+  // Black is stalemated
+  auto stalemate = chess::State::FromFEN("k4/2Q2/1K3/5/5 b - - 0 1");
+  EXPECT_EQ(rollout.Rollout(stalemate), 0);
+}
+
+TEST_F(MCTSTest, TestRolloutDepthCutoff) {
+  RolloutEngine rollout(game_);
+  rollout.SetMaxDepth(1);
+
+  // White (to move) is a queen up with no way to lose it within one move
+  auto state = chess::State::FromFEN("4k/5/5/5/Q3K w - - 0 1");
+
+  double value = rollout.Rollout(state);
+
+  EXPECT_GT(value, 0);
+  EXPECT_LT(value, 1);
+}
+
+TEST_F(MCTSTest, TestSimulationBudget) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+
+  SearchBudget budget;
+  budget.simulations = 30;
+  budget.early_stop = false;
+  mcts_->DrawAction(state, budget);
+
+  EXPECT_EQ(mcts_->GetLastSimulations(), 30);
+  EXPECT_GT(mcts_->GetTreeNodeCount(), 1);
+  EXPECT_GT(mcts_->GetTreeMemoryUsage(), 0);
+}
+
+TEST_F(MCTSTest, TestNodeBudget) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+
+  SearchBudget budget;
+  budget.nodes = 200;
+  budget.early_stop = false;
+  mcts_->DrawAction(state, budget);
+
+  EXPECT_GE(mcts_->GetTreeNodeCount(), 200);
+  EXPECT_LT(mcts_->GetTreeNodeCount(), 400);
+}
+
+TEST_F(MCTSTest, TestTimeBudget) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+
+  SearchBudget budget;
+  budget.time = 50;
+  budget.early_stop = false;
+
+  auto start = std::chrono::steady_clock::now();
+  mcts_->DrawAction(state, budget);
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+  EXPECT_GE(elapsed.count(), 50);
+  EXPECT_LT(elapsed.count(), 1000);
+}
+
+TEST_F(MCTSTest, TestEarlyStopForcedMove) {
+  // White's only legal move is to capture the checking queen with the king
+  auto state = chess::State::FromFEN("k4/5/5/1q3/K4 w - - 0 1");
+
+  SearchBudget budget;
+  budget.simulations = 100;
+  EXPECT_FALSE(budget.early_stop);
+
+  budget.early_stop = true;
+  auto next_state = mcts_->DrawAction(state, budget);
+
+  EXPECT_EQ(mcts_->GetLastSimulations(), 1);
+  EXPECT_EQ(next_state->GetBoard().GetField(1, 1), chess::make_piece(chess::Figure::kKing, chess::Player::kWhite));
+}
+
+// Backup policy counting the number of backups
+struct CountingBackup {
+  int count{0};
+
+  void Backup(const MCTSNode::MCTSNodePtr &node, double value) {
+    ++count;
+    DiscountedBackup().Backup(node, value);
+  }
+};
+
+TEST_F(MCTSTest, TestCustomPolicy) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+
+  GenericMCTS<UCTSelection, RolloutEngine, CountingBackup> mcts(game_);
+  mcts.SetSimulations(20);
+  mcts.DrawAction(state);
+
+  EXPECT_EQ(mcts.GetBackupPolicy().count, 20);
+}
+
+TEST_F(MCTSTest, TestSolverFindsMateInOne) {
+  // Rc1-c5 is mate
+  auto state = chess::State::FromFEN("k4/5/1K3/5/2R2 w - - 0 1");
+  auto root = std::make_shared<MCTSNode>(game_, state);
+
+  SearchBudget budget;
+  budget.simulations = 10000;
+  budget.early_stop = false;
+  auto child = mcts_->DrawAction(root, budget);
+
+  EXPECT_EQ(child->GetProof(), MCTSNode::Proof::kWin);
+  EXPECT_EQ(root->GetProof(), MCTSNode::Proof::kLoss);
+  EXPECT_LT(mcts_->GetLastSimulations(), 10000);
+  EXPECT_EQ(child->GetState()->GetBoard().GetField(2, 4),
+            chess::make_piece(chess::Figure::kRook, chess::Player::kWhite));
+}
+
+TEST_F(MCTSTest, TestSolverProvesLoss) {
+  // Black can only move the king to b5, after which white mates in two
+  auto state = chess::State::FromFEN("k4/5/1KR2/5/5 b - - 0 1");
+  auto root = std::make_shared<MCTSNode>(game_, state);
+
+  SearchBudget budget;
+  budget.simulations = 10000;
+  budget.early_stop = false;
+  mcts_->DrawAction(root, budget);
+
+  EXPECT_EQ(root->GetProof(), MCTSNode::Proof::kWin);
+  EXPECT_LT(mcts_->GetLastSimulations(), 10000);
+}
+
+TEST_F(MCTSTest, TestMemoryBudgetPrunes) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+  auto root = std::make_shared<MCTSNode>(game_, state);
+
+  SearchBudget budget;
+  budget.simulations = 500;
+  budget.memory = 64 * 1024;
+  budget.early_stop = false;
+  mcts_->DrawAction(root, budget);
+
+  EXPECT_EQ(mcts_->GetLastSimulations(), 500);
+  EXPECT_GT(mcts_->GetPrunedNodeCount(), 0);
+  EXPECT_LE(mcts_->GetTreeMemoryUsage(), budget.memory);
+  EXPECT_EQ(root->GetVisitCount(), 500);
+
+  // The statistics of the pruned tree are consistent with a recount
+  long node_count = 0;
+  std::vector<MCTSNode::MCTSNodePtr> stack{root};
+  while (!stack.empty()) {
+    auto node = stack.back();
+    stack.pop_back();
+    ++node_count;
+    for (auto child : node->GetChildren()) stack.push_back(child);
+  }
+
+  EXPECT_EQ(mcts_->GetTreeNodeCount(), node_count);
+}
+
+TEST_F(MCTSTest, TestLazyExpansion) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+  auto node = std::make_shared<MCTSNode>(game_, state);
+
+  node->Expand();
+
+  auto legal_actions = game_->GetLegalActions(state);
+
+  EXPECT_TRUE(node->GetChildren().empty());
+  ASSERT_EQ(node->GetActionCount(), static_cast<int>(legal_actions.size()));
+
+  // Each move is tried exactly once and yields one of the successor states
+  for (int i = 0; i < node->GetActionCount(); ++i) {
+    EXPECT_TRUE(node->IsLeaf());
+
+    auto child = node->ExpandChild();
+
+    EXPECT_EQ(child->GetParent(), node);
+
+    int matches = 0;
+    for (const auto &action : legal_actions) {
+      if (*action == *child->GetState() && action->ToLAN() == child->GetState()->ToLAN()) ++matches;
+    }
+    EXPECT_EQ(matches, 1);
+
+    for (int j = 0; j < i; ++j) EXPECT_NE(child->GetState()->ToLAN(), node->GetChildren().at(j)->GetState()->ToLAN());
+  }
+
+  EXPECT_FALSE(node->IsLeaf());
+}
+
+TEST_F(MCTSTest, TestProgressiveWidening) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+  auto root = std::make_shared<MCTSNode>(game_, state);
+
+  ProgressiveWidening widening{1.0, 0.5};
+  mcts_->SetProgressiveWidening(widening);
+  mcts_->DrawAction(root, {16, 0, 0, 0, false});
+
+  ASSERT_GT(root->GetActionCount(), 4);
+  EXPECT_LE(static_cast<int>(root->GetChildren().size()), widening.GetMaxChildren(16));
+  EXPECT_LT(static_cast<int>(root->GetChildren().size()), root->GetActionCount());
+
+  EXPECT_EQ(widening.GetMaxChildren(0), 1);
+  EXPECT_EQ(widening.GetMaxChildren(16), 4);
+  EXPECT_EQ(ProgressiveWidening().GetMaxChildren(16), INT_MAX);
+}
+
+TEST_F(MCTSTest, TestProgressiveWideningWithSolver) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+  auto root = std::make_shared<MCTSNode>(game_, state);
+
+  root->Expand();
+  ASSERT_GT(root->GetActionCount(), 2);
+
+  // A node whose children are all proven is a leaf even if it reached its maximum number of children.
+  auto lost = root->ExpandChild();
+  EXPECT_FALSE(root->IsLeaf(1));
+  lost->SetProof(MCTSNode::Proof::kLoss);
+  EXPECT_TRUE(root->IsLeaf(1));
+
+  // The search tries other moves instead of descending into the proven loss.
+  mcts_->SetProgressiveWidening({0.01, 0.5});
+  auto child = mcts_->DrawAction(root, {20, 0, 0, 0, false});
+
+  EXPECT_GT(root->GetChildren().size(), 1u);
+  EXPECT_NE(child, lost);
+  EXPECT_NE(child->GetProof(), MCTSNode::Proof::kLoss);
+}
+
+TEST_F(MCTSTest, TestSearchReport) {
+  auto state = chess::State::FromFEN("rnbqk/ppppp/5/PPPPP/RNBQK w - - 0 1");
+  auto root = std::make_shared<MCTSNode>(game_, state);
+
+  mcts_->DrawAction(root, {200, 0, 0, 0, false});
+
+  SearchReport report = mcts_->GetLastReport();
+
+  EXPECT_EQ(report.simulations, 200);
+  EXPECT_EQ(report.tree_nodes, mcts_->GetTreeNodeCount());
+  EXPECT_EQ(report.tree_memory, mcts_->GetTreeMemoryUsage());
+  // All nodes but the root were created by this search
+  EXPECT_EQ(report.nodes_allocated, report.tree_nodes - 1);
+
+  EXPECT_GE(report.max_depth, 1);
+  EXPECT_GE(report.GetAverageDepth(), 1.0);
+  EXPECT_LE(report.GetAverageDepth(), static_cast<double>(report.max_depth));
+  EXPECT_GT(report.GetEffectiveBranchingFactor(), 1.0);
+
+  EXPECT_GT(report.time, 0);
+  EXPECT_GT(report.GetSimulationsPerSecond(), 0.0);
+  EXPECT_LE(report.selection_time + report.expansion_time + report.evaluation_time + report.backup_time, report.time);
+}
+
+TEST(SearchReportTest, TestEffectiveBranchingFactor) {
+  SearchReport report;
+
+  // A complete binary tree of depth 3
+  report.tree_nodes = 15;
+  report.max_depth = 3;
+  EXPECT_NEAR(report.GetEffectiveBranchingFactor(), 2.0, 1e-4);
+
+  report.tree_nodes = 31;
+  report.max_depth = 1;
+  EXPECT_NEAR(report.GetEffectiveBranchingFactor(), 30.0, 1e-4);
+
+  report.max_depth = 0;
+  EXPECT_DOUBLE_EQ(report.GetEffectiveBranchingFactor(), 0.0);
+}